@@ -0,0 +1,116 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+namespace kls::thread::benchmark {
+    inline uint64_t now_ns() noexcept {
+        using namespace std::chrono;
+        return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+    }
+
+    struct Options {
+        std::vector<unsigned int> threads{ 1, 2, 8, 32, 64 };
+        std::chrono::milliseconds duration{ 200 };
+        std::string filter{};
+    };
+
+    // Latency samples in nanoseconds plus the number of operations that completed in the measured window
+    struct Result {
+        std::vector<uint64_t> samples{};
+        uint64_t operations = 0;
+        double seconds = 0;
+        std::string note{};
+    };
+
+    inline void print_header() {
+        std::printf("%-28s %7s %10s %10s %10s %10s %10s %14s  %s\n",
+                    "benchmark", "threads", "p50", "p90", "p99", "p99.9", "max", "ops/s", "");
+    }
+
+    inline void print(const char* name, unsigned int threads, Result& result) {
+        auto& s = result.samples;
+        std::sort(s.begin(), s.end());
+        const auto at = [&s](double q) -> unsigned long long {
+            return s.empty() ? 0 : s[std::min(s.size() - 1, static_cast<std::size_t>(q * static_cast<double>(s.size())))];
+        };
+        const auto rate = result.seconds > 0 ? static_cast<double>(result.operations) / result.seconds : 0.0;
+        std::printf("%-28s %7u %10llu %10llu %10llu %10llu %10llu %14.0f  %s\n",
+                    name, threads, at(0.5), at(0.9), at(0.99), at(0.999), s.empty() ? 0ull : s.back(), rate,
+                    result.note.c_str());
+        std::fflush(stdout);
+    }
+
+    // Starts count threads running body(index, stop) at the same moment, stops them after the configured
+    // duration and returns the measured wall time in seconds
+    inline double run_threads(
+            const Options& options, unsigned int count,
+            const std::function<void(unsigned int, const std::atomic_bool&)>& body
+    ) {
+        std::atomic<unsigned int> ready{ 0 };
+        std::atomic_bool go{ false }, stop{ false };
+        std::vector<std::thread> threads{};
+        for (unsigned int i = 0; i < count; ++i) {
+            threads.emplace_back([&, i]() {
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+                body(i, stop);
+            });
+        }
+        while (ready.load() != count) std::this_thread::yield();
+        const auto start = now_ns();
+        go.store(true, std::memory_order_release);
+        std::this_thread::sleep_for(options.duration);
+        stop.store(true, std::memory_order_release);
+        for (auto& thread: threads) thread.join();
+        return static_cast<double>(now_ns() - start) / 1e9;
+    }
+
+    // Per-thread sample buffers, merged once the threads are done so that recording stays uncontended
+    class Samples {
+    public:
+        explicit Samples(unsigned int threads) : m_buffers(threads) {}
+
+        std::vector<uint64_t>& operator[](unsigned int thread) noexcept { return m_buffers[thread].values; }
+
+        std::vector<uint64_t> merge() {
+            std::vector<uint64_t> result{};
+            for (auto& buffer: m_buffers) result.insert(result.end(), buffer.values.begin(), buffer.values.end());
+            return result;
+        }
+
+    private:
+        struct alignas(64) Buffer { std::vector<uint64_t> values{}; };
+
+        std::vector<Buffer> m_buffers;
+    };
+}
@@ -0,0 +1,280 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include "Harness.h"
+#include "kls/thread/TSS.h"
+#include "kls/thread/SpinLock.h"
+#include "kls/thread/SpinWait.h"
+#include "kls/thread/Semaphore.h"
+
+using namespace kls::thread;
+using namespace kls::thread::benchmark;
+
+namespace {
+    // Every 16th operation is timed, timing all of them would mostly measure the clock
+    constexpr uint64_t SampleEvery = 16;
+
+    Result spin_lock(const Options& options, unsigned int threads) {
+        SpinLock lock{};
+        uint64_t shared = 0;
+        Samples samples{ threads };
+        std::vector<uint64_t> counts(threads);
+        Result result{};
+        result.seconds = run_threads(options, threads, [&](unsigned int i, const std::atomic_bool& stop) {
+            auto& mine = samples[i];
+            uint64_t ops = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                const auto timed = ops % SampleEvery == 0;
+                const auto start = timed ? now_ns() : 0;
+                lock.lock();
+                ++shared;
+                lock.unlock();
+                if (timed) mine.push_back(now_ns() - start);
+                ++ops;
+            }
+            counts[i] = ops;
+        });
+        result.samples = samples.merge();
+        // Jain's index is 1 when every thread got the same share and 1/n when one thread got everything
+        double sum = 0, squares = 0;
+        uint64_t least = UINT64_MAX, most = 0;
+        for (const auto count: counts) {
+            result.operations += count;
+            sum += static_cast<double>(count);
+            squares += static_cast<double>(count) * static_cast<double>(count);
+            least = std::min(least, count);
+            most = std::max(most, count);
+        }
+        char note[96];
+        std::snprintf(note, sizeof(note), "jain=%.3f min/max=%.3f", squares > 0 ? sum * sum / (threads * squares) : 0,
+                      most ? static_cast<double>(least) / static_cast<double>(most) : 0);
+        result.note = note;
+        return result;
+    }
+
+    // Pairs of threads bouncing a unit between two semaphores, samples are round trips
+    Result semaphore_ping_pong(const Options& options, unsigned int threads) {
+        struct Pair {
+            Semaphore ping{}, pong{};
+            std::atomic_bool done{ false };
+        };
+        std::vector<std::unique_ptr<Pair>> pairs{};
+        for (unsigned int i = 0; i < threads / 2; ++i) pairs.push_back(std::make_unique<Pair>());
+        Samples samples{ threads };
+        Result result{};
+        result.seconds = run_threads(options, threads, [&](unsigned int i, const std::atomic_bool& stop) {
+            auto& pair = *pairs[i / 2];
+            if (i % 2) {
+                for (;;) {
+                    pair.ping.wait();
+                    if (pair.done.load(std::memory_order_relaxed)) return;
+                    pair.pong.signal();
+                }
+            }
+            auto& mine = samples[i];
+            while (!stop.load(std::memory_order_relaxed)) {
+                const auto start = now_ns();
+                pair.ping.signal();
+                pair.pong.wait();
+                mine.push_back(now_ns() - start);
+            }
+            pair.done.store(true, std::memory_order_relaxed);
+            pair.ping.signal();
+        });
+        result.samples = samples.merge();
+        result.operations = result.samples.size();
+        result.note = "round trip";
+        return result;
+    }
+
+    // One-way latency from a store to a SpinWait loop noticing it
+    Result spin_wait_wake(const Options& options, unsigned int threads) {
+        struct alignas(64) Pair {
+            std::atomic<uint64_t> stamp{ 0 };
+            std::atomic_bool seen{ false };
+        };
+        constexpr auto Done = UINT64_MAX;
+        std::vector<std::unique_ptr<Pair>> pairs{};
+        for (unsigned int i = 0; i < threads / 2; ++i) pairs.push_back(std::make_unique<Pair>());
+        Samples samples{ threads };
+        Result result{};
+        result.seconds = run_threads(options, threads, [&](unsigned int i, const std::atomic_bool& stop) {
+            auto& pair = *pairs[i / 2];
+            if (i % 2) {
+                auto& mine = samples[i];
+                for (;;) {
+                    SpinWait spinner{};
+                    uint64_t stamp;
+                    while (!(stamp = pair.stamp.load(std::memory_order_acquire))) spinner.once();
+                    if (stamp == Done) return;
+                    mine.push_back(now_ns() - stamp);
+                    pair.stamp.store(0, std::memory_order_relaxed);
+                    pair.seen.store(true, std::memory_order_release);
+                }
+            }
+            while (!stop.load(std::memory_order_relaxed)) {
+                pair.stamp.store(now_ns(), std::memory_order_release);
+                SpinWait spinner{};
+                while (!pair.seen.load(std::memory_order_acquire)) spinner.once();
+                pair.seen.store(false, std::memory_order_relaxed);
+            }
+            pair.stamp.store(Done, std::memory_order_release);
+        });
+        result.samples = samples.merge();
+        result.operations = result.samples.size();
+        result.note = "one way";
+        return result;
+    }
+
+    void noop_cleanup(void*, void*) noexcept {}
+
+    // Samples are the time of 1000 operations, a single one is too short for the clock
+    template<class Op>
+    Result tss_access(const Options& options, unsigned int threads, Op op) {
+        Samples samples{ threads };
+        Result result{};
+        std::atomic<uint64_t> operations{ 0 };
+        result.seconds = run_threads(options, threads, [&](unsigned int i, const std::atomic_bool& stop) {
+            auto& mine = samples[i];
+            uint64_t ops = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                const auto start = now_ns();
+                for (int j = 0; j < 1000; ++j) op(j);
+                mine.push_back(now_ns() - start);
+                ops += 1000;
+            }
+            operations += ops;
+        });
+        result.samples = samples.merge();
+        result.operations = operations;
+        result.note = "ns per 1000 ops";
+        return result;
+    }
+
+    struct TssKeys {
+        tss::detail::Key inline_key{}, overflow_key{};
+        std::vector<tss::detail::Key> filler{};
+
+        TssKeys() {
+            inline_key = tss::detail::create({ &noop_cleanup, nullptr });
+            do {
+                filler.push_back(overflow_key = tss::detail::create({ &noop_cleanup, nullptr }));
+            } while (overflow_key.index < tss::detail::inline_slots);
+        }
+
+        ~TssKeys() {
+            tss::detail::remove(inline_key);
+            for (auto key: filler) tss::detail::remove(key);
+        }
+    };
+
+    Result tss_get(const Options& options, unsigned int threads, bool overflow) {
+        TssKeys keys{};
+        const auto key = overflow ? keys.overflow_key : keys.inline_key;
+        static thread_local int value;
+        return tss_access(options, threads, [key](int) noexcept {
+            if (!tss::detail::get(key)) tss::detail::set(key, &value);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        });
+    }
+
+    Result tss_set(const Options& options, unsigned int threads) {
+        TssKeys keys{};
+        static thread_local int values[2];
+        return tss_access(options, threads, [&keys](int j) { tss::detail::set(keys.inline_key, &values[j & 1]); });
+    }
+
+    // Every thread keeps a value bound so that its context stays alive, then churns keys
+    Result tss_key_churn(const Options& options, unsigned int threads) {
+        TssKeys keys{};
+        Samples samples{ threads };
+        Result result{};
+        result.seconds = run_threads(options, threads, [&](unsigned int i, const std::atomic_bool& stop) {
+            static thread_local int value;
+            tss::detail::set(keys.inline_key, &value);
+            auto& mine = samples[i];
+            while (!stop.load(std::memory_order_relaxed)) {
+                const auto start = now_ns();
+                const auto key = tss::detail::create({ &noop_cleanup, nullptr });
+                tss::detail::set(key, &value);
+                tss::detail::remove(key);
+                mine.push_back(now_ns() - start);
+            }
+        });
+        result.samples = samples.merge();
+        result.operations = result.samples.size();
+        result.note = "create + set + remove";
+        return result;
+    }
+
+    struct Case {
+        const char* name;
+        unsigned int min_threads;
+        std::function<Result(const Options&, unsigned int)> run;
+    };
+
+    std::vector<unsigned int> parse_threads(const char* list) {
+        std::vector<unsigned int> result{};
+        for (auto p = list; *p;) {
+            char* end;
+            const auto value = std::strtoul(p, &end, 10);
+            if (end == p) break;
+            if (value) result.push_back(static_cast<unsigned int>(value));
+            p = *end == ',' ? end + 1 : end;
+        }
+        return result;
+    }
+}
+
+// kls.thread.benchmark [--threads=1,2,8,32,64] [--ms=200] [filter]
+int main(int argc, char** argv) {
+    Options options{};
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strncmp(argv[i], "--threads=", 10)) options.threads = parse_threads(argv[i] + 10);
+        else if (!std::strncmp(argv[i], "--ms=", 5)) options.duration = std::chrono::milliseconds(std::atoi(argv[i] + 5));
+        else options.filter = argv[i];
+    }
+    const Case cases[] = {
+            { "spinlock",              1, spin_lock },
+            { "semaphore.ping_pong",   2, semaphore_ping_pong },
+            { "spinwait.wake",         2, spin_wait_wake },
+            { "tss.get.inline",        1, [](auto& o, auto n) { return tss_get(o, n, false); } },
+            { "tss.get.overflow",      1, [](auto& o, auto n) { return tss_get(o, n, true); } },
+            { "tss.set",               1, tss_set },
+            { "tss.key_churn",         1, tss_key_churn },
+    };
+    print_header();
+    for (auto& c: cases) {
+        if (!options.filter.empty() && !std::strstr(c.name, options.filter.c_str())) continue;
+        for (const auto threads: options.threads) {
+            if (threads < c.min_threads) continue;
+            // Pairwise cases need an even number of threads
+            const auto count = c.min_threads == 2 ? threads & ~1u : threads;
+            auto result = c.run(options, count);
+            print(c.name, count, result);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "kls/thread/Futex.h"
+#include "kls/thread/Barrier.h"
+
+namespace kls::thread {
+    namespace {
+        uint32_t nodes_for(uint32_t arrivals) noexcept {
+            uint32_t total = 0;
+            for (; arrivals > 1; arrivals = (arrivals + 1) / 2) total += (arrivals + 1) / 2;
+            return total;
+        }
+
+        // Node states of a phase: empty, half after the first of a pair, full after the second, which is
+        // the empty state of the next phase
+        constexpr uint32_t empty(uint32_t phase) noexcept { return phase * 2; }
+
+        uint32_t thread_ordinal() noexcept {
+            static std::atomic<uint32_t> next{ 0 };
+            static thread_local const auto ordinal = next.fetch_add(1, std::memory_order_relaxed);
+            return ordinal;
+        }
+    }
+
+    BarrierBase::BarrierBase(uint32_t expected) :
+            m_nodes(std::make_unique<Node[]>(nodes_for(expected))), m_expected(expected) { shape(0); }
+
+    void BarrierBase::shape(uint32_t phase) {
+        m_levels.clear();
+        uint32_t first = 0;
+        for (auto arrivals = m_expected; arrivals > 1;) {
+            const auto count = (arrivals + 1) / 2;
+            m_levels.push_back({ first, count, (arrivals & 1) != 0 });
+            for (uint32_t i = 0; i < count; ++i) m_nodes[first + i].state.store(empty(phase), std::memory_order_relaxed);
+            if (arrivals & 1) m_nodes[first + count - 1].state.store(empty(phase) + 1, std::memory_order_relaxed);
+            first += count;
+            arrivals = count;
+        }
+    }
+
+    bool BarrierBase::arrive(uint32_t& phase) noexcept {
+        phase = m_phase.load(std::memory_order_acquire);
+        const auto free = empty(phase), half = free + 1;
+        auto index = thread_ordinal();
+        for (const auto& level: m_levels) {
+            // A level has exactly as many places as arrivals, so the probe always finds one
+            for (auto probe = index;; ++probe) {
+                auto& node = m_nodes[level.first + probe % level.count].state;
+                auto state = node.load(std::memory_order_relaxed);
+                if (state == free && node.compare_exchange_strong(state, half, std::memory_order_acq_rel)) return false;
+                if (state == half && node.compare_exchange_strong(state, half + 1, std::memory_order_acq_rel)) {
+                    index = probe % level.count / 2;
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    void BarrierBase::complete(uint32_t phase) noexcept {
+        const auto next = phase + 1;
+        if (const auto drops = m_drops.exchange(0, std::memory_order_relaxed); drops) {
+            m_expected -= drops;
+            shape(next);
+        }
+        else {
+            // Full nodes already read as empty for the next phase, only the half-full ones need a touch
+            for (const auto& level: m_levels) {
+                if (level.odd) m_nodes[level.first + level.count - 1].state.store(empty(next) + 1, std::memory_order_relaxed);
+            }
+        }
+        m_phase.store(next, std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_seq_cst)) futex::wake_all(m_phase);
+    }
+
+    void BarrierBase::wait(uint32_t phase) noexcept {
+        AdaptiveSpinWait spinner{ m_budget };
+        while (spinner.spinning()) {
+            if (m_phase.load(std::memory_order_acquire) != phase) {
+                spinner.complete();
+                return;
+            }
+            spinner.once();
+        }
+        m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+        while (m_phase.load(std::memory_order_seq_cst) == phase) futex::wait(m_phase, phase);
+        m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        spinner.complete();
+    }
+}
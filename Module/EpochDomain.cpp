@@ -0,0 +1,131 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <mutex>
+#include <utility>
+#include "kls/thread/EpochDomain.h"
+
+namespace kls::thread {
+    void EpochDomain::Bag::free() noexcept {
+        for (auto& item: items) item.deleter(item.pointer);
+        items.clear();
+    }
+
+    EpochDomain::Registry::~Registry() noexcept {
+        for (auto& bag: orphans) bag.free();
+        for (auto record = head.load(std::memory_order_acquire); record;) {
+            for (auto& bag: record->bags) bag.free();
+            delete std::exchange(record, record->next);
+        }
+    }
+
+    EpochDomain& EpochDomain::global() noexcept {
+        // Leaked on purpose, threads may still exit and hand off garbage during static destruction
+        static const auto domain = new EpochDomain();
+        return *domain;
+    }
+
+    EpochDomain::Record& EpochDomain::acquire_record() noexcept {
+        Record* record = nullptr;
+        for (auto it = m_registry.head.load(std::memory_order_acquire); it; it = it->next) {
+            auto expect = false;
+            if (!it->in_use.load(std::memory_order_relaxed) &&
+                it->in_use.compare_exchange_strong(expect, true, std::memory_order_acquire)) {
+                record = it;
+                break;
+            }
+        }
+        if (!record) {
+            record = new Record();
+            record->next = m_registry.head.load(std::memory_order_relaxed);
+            while (!m_registry.head.compare_exchange_weak(record->next, record, std::memory_order_release)) {}
+        }
+        m_local.reset(record);
+        return *record;
+    }
+
+    void EpochDomain::release_record(void* p, void* user) noexcept {
+        const auto self = static_cast<EpochDomain*>(user);
+        const auto record = static_cast<Record*>(p);
+        if (!record) return;
+        {
+            std::lock_guard lock(self->m_registry.lock);
+            for (auto& bag: record->bags) {
+                if (bag.items.empty()) continue;
+                self->m_registry.orphans.push_back(std::move(bag));
+                bag.items.clear();
+            }
+            self->m_registry.has_orphans.store(!self->m_registry.orphans.empty(), std::memory_order_relaxed);
+        }
+        record->nesting = record->retired = 0;
+        record->state.store(0, std::memory_order_relaxed);
+        record->in_use.store(false, std::memory_order_release);
+    }
+
+    void EpochDomain::retire(void* p, void (* deleter)(void*) noexcept) {
+        auto& record = local();
+        const auto epoch = m_epoch.load(std::memory_order_seq_cst);
+        auto& bag = record.bags[epoch % 3];
+        // A bag of the same slot but another epoch is at least three epochs old
+        if (bag.epoch != epoch) {
+            bag.free();
+            bag.epoch = epoch;
+        }
+        bag.items.push_back({ p, deleter });
+        if (++record.retired >= CollectEvery) collect(record);
+    }
+
+    void EpochDomain::collect() noexcept { collect(local()); }
+
+    bool EpochDomain::try_advance() noexcept {
+        auto epoch = m_epoch.load(std::memory_order_seq_cst);
+        for (auto it = m_registry.head.load(std::memory_order_acquire); it; it = it->next) {
+            const auto state = it->state.load(std::memory_order_seq_cst);
+            if ((state & Active) && (state >> 1) != epoch) return false;
+        }
+        return m_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+    }
+
+    void EpochDomain::collect(Record& record) noexcept {
+        record.retired = 0;
+        try_advance();
+        const auto epoch = m_epoch.load(std::memory_order_seq_cst);
+        for (auto& bag: record.bags) if (bag.epoch + 2 <= epoch) bag.free();
+        if (!m_registry.has_orphans.load(std::memory_order_relaxed)) return;
+        std::vector<Bag> expired{};
+        {
+            std::lock_guard lock(m_registry.lock);
+            auto& orphans = m_registry.orphans;
+            for (std::size_t i = 0; i < orphans.size();) {
+                if (orphans[i].epoch + 2 > epoch) {
+                    ++i;
+                    continue;
+                }
+                expired.push_back(std::move(orphans[i]));
+                orphans[i] = std::move(orphans.back());
+                orphans.pop_back();
+            }
+            m_registry.has_orphans.store(!orphans.empty(), std::memory_order_relaxed);
+        }
+        for (auto& bag: expired) bag.free();
+    }
+}
@@ -0,0 +1,127 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "kls/thread/Futex.h"
+
+#if __has_include(<linux/futex.h>)
+
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace {
+    long futex(std::atomic<uint32_t>& word, int op, uint32_t value, const timespec* timeout) noexcept {
+        return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), op, value, timeout, nullptr, 0);
+    }
+}
+
+namespace kls::thread::futex {
+    void wait(std::atomic<uint32_t>& word, uint32_t expect) noexcept {
+        ::futex(word, FUTEX_WAIT_PRIVATE, expect, nullptr);
+    }
+
+    bool wait_for(std::atomic<uint32_t>& word, uint32_t expect, std::chrono::nanoseconds timeout) noexcept {
+        if (timeout.count() <= 0) return false;
+        const auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        const timespec spec{ static_cast<time_t>(secs.count()), static_cast<long>((timeout - secs).count()) };
+        return !(::futex(word, FUTEX_WAIT_PRIVATE, expect, &spec) == -1 && errno == ETIMEDOUT);
+    }
+
+    void wake(std::atomic<uint32_t>& word, uint32_t count) noexcept {
+        if (count > INT_MAX) count = INT_MAX;
+        ::futex(word, FUTEX_WAKE_PRIVATE, count, nullptr);
+    }
+
+    void wake_all(std::atomic<uint32_t>& word) noexcept { ::futex(word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr); }
+}
+
+#elif __has_include(<Windows.h>)
+
+#include "kls/hal/System.h"
+
+namespace kls::thread::futex {
+    void wait(std::atomic<uint32_t>& word, uint32_t expect) noexcept {
+        WaitOnAddress(&word, &expect, sizeof(uint32_t), INFINITE);
+    }
+
+    bool wait_for(std::atomic<uint32_t>& word, uint32_t expect, std::chrono::nanoseconds timeout) noexcept {
+        if (timeout.count() <= 0) return false;
+        // Round up so that we never wake before the deadline
+        const auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+        const auto wait = static_cast<DWORD>(ms < INFINITE ? ms : INFINITE - 1);
+        return WaitOnAddress(&word, &expect, sizeof(uint32_t), wait) || GetLastError() != ERROR_TIMEOUT;
+    }
+
+    void wake(std::atomic<uint32_t>& word, uint32_t count) noexcept {
+        for (uint32_t i = 0; i < count; ++i) WakeByAddressSingle(&word);
+    }
+
+    void wake_all(std::atomic<uint32_t>& word) noexcept { WakeByAddressAll(&word); }
+}
+
+#else
+
+#include <mutex>
+#include <condition_variable>
+
+namespace {
+    struct alignas(64) Bucket {
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    Bucket& bucket(const void* address) noexcept {
+        static Bucket buckets[256];
+        const auto hash = reinterpret_cast<uintptr_t>(address) >> 2;
+        return buckets[(hash ^ (hash >> 8)) % 256];
+    }
+}
+
+namespace kls::thread::futex {
+    void wait(std::atomic<uint32_t>& word, uint32_t expect) noexcept {
+        auto& b = bucket(&word);
+        std::unique_lock lock(b.mutex);
+        if (word.load(std::memory_order_relaxed) == expect) b.cv.wait(lock);
+    }
+
+    bool wait_for(std::atomic<uint32_t>& word, uint32_t expect, std::chrono::nanoseconds timeout) noexcept {
+        if (timeout.count() <= 0) return false;
+        auto& b = bucket(&word);
+        std::unique_lock lock(b.mutex);
+        if (word.load(std::memory_order_relaxed) != expect) return true;
+        return b.cv.wait_for(lock, timeout) == std::cv_status::no_timeout;
+    }
+
+    // Buckets are shared between addresses, so every waiter in the bucket has to re-check its word
+    void wake(std::atomic<uint32_t>& word, uint32_t) noexcept { wake_all(word); }
+
+    void wake_all(std::atomic<uint32_t>& word) noexcept {
+        auto& b = bucket(&word);
+        { std::lock_guard lock(b.mutex); }
+        b.cv.notify_all();
+    }
+}
+
+#endif
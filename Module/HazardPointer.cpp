@@ -0,0 +1,131 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <mutex>
+#include <utility>
+#include <exception>
+#include <algorithm>
+#include "kls/thread/HazardPointer.h"
+
+namespace kls::thread {
+    HazardDomain::Registry::~Registry() noexcept {
+        for (auto& item: orphans) item.deleter(item.pointer);
+        for (auto record = head.load(std::memory_order_acquire); record;) {
+            for (auto& item: record->retired) item.deleter(item.pointer);
+            delete std::exchange(record, record->next);
+        }
+    }
+
+    HazardDomain& HazardDomain::global() noexcept {
+        // Leaked on purpose, threads may still exit and hand off garbage during static destruction
+        static const auto domain = new HazardDomain();
+        return *domain;
+    }
+
+    void HazardDomain::Holder::release() noexcept {
+        reset();
+        m_record->used &= ~(1u << m_slot);
+    }
+
+    HazardDomain::Holder HazardDomain::make_holder() noexcept {
+        auto& record = local();
+        for (unsigned int slot = 0; slot < SlotsPerThread; ++slot) {
+            if (record.used & (1u << slot)) continue;
+            record.used |= 1u << slot;
+            return { &record, slot };
+        }
+        std::terminate();
+    }
+
+    HazardDomain::Record& HazardDomain::acquire_record() noexcept {
+        Record* record = nullptr;
+        for (auto it = m_registry.head.load(std::memory_order_acquire); it; it = it->next) {
+            auto expect = false;
+            if (!it->in_use.load(std::memory_order_relaxed) &&
+                it->in_use.compare_exchange_strong(expect, true, std::memory_order_acquire)) {
+                record = it;
+                break;
+            }
+        }
+        if (!record) {
+            record = new Record();
+            record->next = m_registry.head.load(std::memory_order_relaxed);
+            while (!m_registry.head.compare_exchange_weak(record->next, record, std::memory_order_release)) {}
+            m_registry.records.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_local.reset(record);
+        return *record;
+    }
+
+    void HazardDomain::release_record(void* p, void* user) noexcept {
+        const auto self = static_cast<HazardDomain*>(user);
+        const auto record = static_cast<Record*>(p);
+        if (!record) return;
+        for (auto& hazard: record->hazards) hazard.store(nullptr, std::memory_order_relaxed);
+        if (!record->retired.empty()) {
+            std::lock_guard lock(self->m_registry.lock);
+            auto& orphans = self->m_registry.orphans;
+            orphans.insert(orphans.end(), record->retired.begin(), record->retired.end());
+            self->m_registry.has_orphans.store(true, std::memory_order_relaxed);
+        }
+        record->retired.clear();
+        record->used = 0;
+        record->in_use.store(false, std::memory_order_release);
+    }
+
+    void HazardDomain::retire(void* p, void (* deleter)(void*) noexcept) {
+        auto& record = local();
+        record.retired.push_back({ p, deleter });
+        // Scanning once the list outgrows twice the number of slots frees at least half of it every time
+        const auto threshold = 2 * SlotsPerThread * m_registry.records.load(std::memory_order_relaxed) + 16;
+        if (record.retired.size() >= threshold) scan(record);
+    }
+
+    void HazardDomain::scan() noexcept { scan(local()); }
+
+    void HazardDomain::scan(Record& record) noexcept {
+        auto candidates = std::move(record.retired);
+        record.retired.clear();
+        if (m_registry.has_orphans.load(std::memory_order_relaxed)) {
+            std::lock_guard lock(m_registry.lock);
+            auto& orphans = m_registry.orphans;
+            candidates.insert(candidates.end(), orphans.begin(), orphans.end());
+            orphans.clear();
+            m_registry.has_orphans.store(false, std::memory_order_relaxed);
+        }
+        // Pairs with the fence in protect(): a reader that published its hazard too late re-reads the source
+        // and sees that the node has been unlinked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<const void*> hazards{};
+        for (auto it = m_registry.head.load(std::memory_order_acquire); it; it = it->next) {
+            for (auto& hazard: it->hazards) {
+                if (const auto p = hazard.load(std::memory_order_acquire); p) hazards.push_back(p);
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+        for (auto& item: candidates) {
+            if (std::binary_search(hazards.begin(), hazards.end(), static_cast<const void*>(item.pointer)))
+                record.retired.push_back(item);
+            else item.deleter(item.pointer);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "kls/thread/LockStats.h"
+
+namespace {
+    std::atomic<kls::thread::stats::Site*> sites{ nullptr };
+}
+
+namespace kls::thread::stats {
+    Site::Site(const char* name) noexcept: mName(name), mNext(sites.load(std::memory_order_relaxed)) {
+        while (!sites.compare_exchange_weak(mNext, this, std::memory_order_release, std::memory_order_relaxed)) {}
+    }
+
+    Snapshot Site::snapshot() const noexcept {
+        Snapshot result{
+            mName,
+            mAcquisitions.load(std::memory_order_relaxed),
+            mContended.load(std::memory_order_relaxed),
+            mSpins.load(std::memory_order_relaxed),
+            mWaitNs.load(std::memory_order_relaxed),
+            mHoldNs.load(std::memory_order_relaxed),
+            {}
+        };
+        for (std::size_t i = 0; i < HistogramBuckets; ++i) {
+            result.wait_histogram[i] = mHistogram[i].load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    void Site::reset() noexcept {
+        for (auto counter: { &mAcquisitions, &mContended, &mSpins, &mWaitNs, &mHoldNs }) {
+            counter->store(0, std::memory_order_relaxed);
+        }
+        for (auto& bucket: mHistogram) bucket.store(0, std::memory_order_relaxed);
+    }
+
+    std::vector<Snapshot> Site::collect() {
+        std::vector<Snapshot> result{};
+        for (auto it = sites.load(std::memory_order_acquire); it; it = it->mNext) result.push_back(it->snapshot());
+        return result;
+    }
+}
@@ -0,0 +1,58 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <utility>
+#include "kls/thread/McsLock.h"
+
+namespace {
+    using Node = kls::thread::McsLockBase::Node;
+
+    // Queue nodes are only referenced by the lock while their owner is queued or holding it,
+    // so they can be recycled by whichever thread released them
+    class NodeCache {
+    public:
+        ~NodeCache() noexcept {
+            while (m_head) delete std::exchange(m_head, m_head->free_next);
+        }
+
+        Node* pop() noexcept {
+            if (m_head) return std::exchange(m_head, m_head->free_next);
+            return new Node{};
+        }
+
+        void push(Node* node) noexcept { node->free_next = std::exchange(m_head, node); }
+
+    private:
+        Node* m_head{ nullptr };
+    };
+
+    NodeCache& cache() noexcept {
+        static thread_local NodeCache instance{};
+        return instance;
+    }
+}
+
+namespace kls::thread {
+    McsLockBase::Node* McsLockBase::acquire_node() noexcept { return cache().pop(); }
+
+    void McsLockBase::release_node(Node* node) noexcept { cache().push(node); }
+}
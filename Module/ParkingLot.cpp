@@ -0,0 +1,178 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "kls/thread/Futex.h"
+#include "kls/thread/CacheLine.h"
+#include "kls/thread/SpinLock.h"
+#include "kls/thread/ParkingLot.h"
+
+namespace kls::thread::parking_lot {
+    namespace {
+        constexpr uint32_t Parked = 0, Unparked = 1;
+
+        struct ThreadData {
+            std::atomic<uint32_t> token{ Unparked };
+            const void* address = nullptr;
+            ThreadData* next = nullptr;
+        };
+
+        struct alignas(CacheLineSize) Bucket {
+            SpinLock lock{};
+            ThreadData* head = nullptr;
+            ThreadData* tail = nullptr;
+
+            void enqueue(ThreadData* thread) noexcept {
+                thread->next = nullptr;
+                if (tail) tail->next = thread; else head = thread;
+                tail = thread;
+            }
+
+            // Unlinks the first thread parked on address, and tells whether another one is still queued
+            ThreadData* dequeue(const void* address, bool& have_more) noexcept {
+                ThreadData* prev = nullptr;
+                auto found = head;
+                while (found && found->address != address) found = (prev = found)->next;
+                have_more = false;
+                if (!found) return nullptr;
+                unlink(prev, found);
+                for (auto it = found->next; it; it = it->next) {
+                    if (it->address == address) {
+                        have_more = true;
+                        break;
+                    }
+                }
+                return found;
+            }
+
+            bool remove(ThreadData* thread) noexcept {
+                ThreadData* prev = nullptr;
+                for (auto it = head; it; prev = it, it = it->next) {
+                    if (it != thread) continue;
+                    unlink(prev, it);
+                    return true;
+                }
+                return false;
+            }
+
+            void unlink(ThreadData* prev, ThreadData* thread) noexcept {
+                if (prev) prev->next = thread->next; else head = thread->next;
+                if (tail == thread) tail = prev;
+            }
+        };
+
+        // Fixed size, parked threads of unrelated addresses sharing a bucket only cost a longer scan
+        constexpr std::size_t BucketCount = 1024;
+
+        Bucket& bucket_of(const void* address) noexcept {
+            static Bucket buckets[BucketCount];
+            const auto key = reinterpret_cast<uintptr_t>(address);
+            return buckets[static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 54) % BucketCount];
+        }
+
+        ThreadData& this_thread() noexcept {
+            static thread_local ThreadData data{};
+            return data;
+        }
+
+        void wake(ThreadData* thread) noexcept {
+            thread->token.store(Unparked, std::memory_order_release);
+            futex::wake(thread->token, 1);
+        }
+    }
+
+    namespace detail {
+        ParkResult park(
+                const void* address, bool (* validate)(void*), void* validate_ctx,
+                void (* before_sleep)(void*), void* before_sleep_ctx, const Clock::time_point* deadline
+        ) noexcept {
+            auto& self = this_thread();
+            auto& bucket = bucket_of(address);
+            {
+                std::lock_guard lock(bucket.lock);
+                if (!validate(validate_ctx)) return ParkResult::Invalid;
+                self.address = address;
+                self.token.store(Parked, std::memory_order_relaxed);
+                bucket.enqueue(&self);
+            }
+            before_sleep(before_sleep_ctx);
+            while (self.token.load(std::memory_order_acquire) == Parked) {
+                if (!deadline) {
+                    futex::wait(self.token, Parked);
+                    continue;
+                }
+                if (futex::wait_until(self.token, Parked, *deadline)) continue;
+                // Timed out, unless an unpark has dequeued us in the meantime and is about to wake us
+                {
+                    std::lock_guard lock(bucket.lock);
+                    if (bucket.remove(&self)) return ParkResult::TimedOut;
+                }
+                while (self.token.load(std::memory_order_acquire) == Parked) futex::wait(self.token, Parked);
+            }
+            return ParkResult::Unparked;
+        }
+
+        UnparkResult unpark_one(const void* address, void (* callback)(void*, UnparkResult), void* ctx) noexcept {
+            auto& bucket = bucket_of(address);
+            UnparkResult result{};
+            ThreadData* thread;
+            {
+                std::lock_guard lock(bucket.lock);
+                thread = bucket.dequeue(address, result.have_more);
+                result.unparked = thread;
+                if (callback) callback(ctx, result);
+            }
+            if (thread) wake(thread);
+            return result;
+        }
+    }
+
+    unsigned int unpark_all(const void* address) noexcept {
+        auto& bucket = bucket_of(address);
+        ThreadData* woken = nullptr;
+        {
+            std::lock_guard lock(bucket.lock);
+            ThreadData* prev = nullptr;
+            for (auto it = bucket.head; it;) {
+                const auto next = it->next;
+                if (it->address == address) {
+                    bucket.unlink(prev, it);
+                    it->next = woken;
+                    woken = it;
+                }
+                else prev = it;
+                it = next;
+            }
+        }
+        // Woken in reverse, which does not matter as they all compete for the same thing anyway
+        unsigned int count = 0;
+        while (woken) {
+            const auto next = woken->next;
+            wake(woken);
+            woken = next;
+            ++count;
+        }
+        return count;
+    }
+}
@@ -0,0 +1,55 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "kls/thread/SpinWait.h"
+#include "kls/thread/ParkingMutex.h"
+
+namespace kls::thread {
+    void ParkingMutex::lock_slow() noexcept {
+        SpinWait spinner{};
+        for (;;) {
+            auto state = mState.load(std::memory_order_relaxed);
+            if (!(state & Locked)) {
+                if (mState.compare_exchange_weak(state, state | Locked, std::memory_order_acquire)) return;
+                continue;
+            }
+            // Spin while nobody is parked yet, once someone is the owner will hand off through the lot anyway
+            if (!(state & HasParked) && !spinner.will_yield()) {
+                spinner.once();
+                continue;
+            }
+            if (!(state & HasParked) &&
+                !mState.compare_exchange_weak(state, state | HasParked, std::memory_order_relaxed))
+                continue;
+            parking_lot::park(&mState, [this]() noexcept {
+                return mState.load(std::memory_order_relaxed) == (Locked | HasParked);
+            });
+        }
+    }
+
+    void ParkingMutex::unlock_slow() noexcept {
+        // HasParked is only cleared while the queue is locked, so a thread about to park cannot miss us
+        parking_lot::unpark_one(&mState, [this](parking_lot::UnparkResult result) noexcept {
+            mState.store(result.have_more ? HasParked : Unlocked, std::memory_order_release);
+        });
+    }
+}
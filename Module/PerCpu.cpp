@@ -0,0 +1,58 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include "kls/thread/PerCpu.h"
+
+#if defined(__linux__) && __has_include(<unistd.h>)
+#include <unistd.h>
+#define KLS_THREAD_LINUX_POSSIBLE_CPUS
+#endif
+
+namespace kls::thread::percpu {
+    unsigned int count() noexcept {
+        static const unsigned int value = []() noexcept {
+            unsigned int result = 1;
+            for (auto& cpu: Topology::get().cpus()) result = std::max(result, cpu.id + 1);
+#ifdef KLS_THREAD_LINUX_POSSIBLE_CPUS
+            // The possible mask, e.g. "0-63", bounds every id the kernel will ever hand out
+            try {
+                std::ifstream file("/sys/devices/system/cpu/possible");
+                std::string list;
+                if (std::getline(file, list) && !list.empty()) {
+                    const auto last = list.find_last_of(",-");
+                    result = std::max(result, static_cast<unsigned int>(
+                            std::stoul(list.substr(last == std::string::npos ? 0 : last + 1)) + 1
+                    ));
+                }
+            }
+            catch (...) {}
+            if (const auto configured = sysconf(_SC_NPROCESSORS_CONF); configured > 0)
+                result = std::max(result, static_cast<unsigned int>(configured));
+#endif
+            return result;
+        }();
+        return value;
+    }
+}
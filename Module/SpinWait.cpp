@@ -21,10 +21,13 @@
 */
 
 #include <cmath>
+#include <cstdlib>
 #include "kls/hal/Perf.h"
 #include "kls/thread/SpinWait.h"
+#include "kls/thread/Topology.h"
 
 namespace {
+    constexpr unsigned int DefaultOptimalMaxNormalizedYieldsPerSpinIteration = 7;
     constexpr unsigned int MinNsPerNormalizedYield = 37; // measured typically 37-46 on post-Skylake
     constexpr unsigned int NsPerOptimalMaxSpinIterationDuration = 272;
     // approx. 900 cycles, measured 281 on pre-Skylake, 263 on post-Skylake
@@ -38,7 +41,7 @@ namespace {
         auto ticksPerSecond = kls::hal::performance::frequency();
         if (!ticksPerSecond || ticksPerSecond < 1000 / MeasureDurationMs) {
             // High precision clock not available or clock resolution is too low, resort to defaults
-            return 7;
+            return DefaultOptimalMaxNormalizedYieldsPerSpinIteration;
         }
 
         // Measure the nanosecond delay per yield
@@ -73,10 +76,61 @@ namespace {
 
         return optimalMaxNormalizedYieldsPerSpinIteration;
     }
+
+    unsigned int ConfiguredYieldProcessorNormalized() noexcept {
+        const auto value = std::getenv("KLS_THREAD_SPIN_CALIBRATION");
+        if (!value) return 0;
+        const auto parsed = std::strtoul(value, nullptr, 10);
+        return parsed > 0 && parsed < 1024 ? static_cast<unsigned int>(parsed) : 0;
+    }
 }
 
 namespace kls::thread {
-    bool SpinWait::IsSingleProcessor = std::thread::hardware_concurrency() == 1;
-    unsigned int SpinWait::SpinCountForSpinBeforeWait = IsSingleProcessor ? 1 : 35;
-    unsigned int SpinWait::OptimalMaxSpinWaitsPerSpinIteration = InitializeYieldProcessorNormalized();
+    // Based on the CPUs we may actually run on, a container capped at one CPU on a big host must not spin
+    bool SpinWait::single_processor() noexcept {
+        static const bool value = Topology::get().concurrency() == 1;
+        return value;
+    }
+
+    // With only a couple of CPUs the awaited thread is likely descheduled, so give up spinning sooner
+    unsigned int SpinWait::spin_count_before_wait() noexcept {
+        static const unsigned int value = single_processor() ? 1 : Topology::get().concurrency() <= 2 ? 10 : 35;
+        return value;
+    }
+
+    std::atomic<unsigned int> SpinWait::OptimalMaxSpinWaitsPerSpinIteration{ 0 };
+
+    unsigned int SpinWait::calibrate() noexcept {
+        const auto value = InitializeYieldProcessorNormalized();
+        set_calibration(value);
+        return value;
+    }
+
+    void SpinWait::set_calibration(const unsigned int value) noexcept {
+        OptimalMaxSpinWaitsPerSpinIteration.store(value ? value : 1, std::memory_order_relaxed);
+    }
+
+    unsigned int SpinWait::calibrate_lazily() noexcept {
+        // Static local initialization makes sure that only the first caller kicks off the measurement,
+        // which runs on its own thread so that no spinning caller has to stall for it
+        static const auto fallback = []() noexcept {
+            if (const auto configured = ConfiguredYieldProcessorNormalized(); configured) {
+                set_calibration(configured);
+                return configured;
+            }
+            try {
+                std::thread([]() noexcept {
+                    auto expect = 0u;
+                    const auto value = InitializeYieldProcessorNormalized();
+                    OptimalMaxSpinWaitsPerSpinIteration.compare_exchange_strong(expect, value, std::memory_order_relaxed);
+                }).detach();
+            }
+            catch (...) {
+                set_calibration(DefaultOptimalMaxNormalizedYieldsPerSpinIteration);
+            }
+            return DefaultOptimalMaxNormalizedYieldsPerSpinIteration;
+        }();
+        const auto value = OptimalMaxSpinWaitsPerSpinIteration.load(std::memory_order_relaxed);
+        return value ? value : fallback;
+    }
 }
@@ -22,12 +22,25 @@
 
 #include <stack>
 #include <mutex>
+#include <memory>
+#include <utility>
+#include <atomic>
 #include "kls/temp/STL.h"
 #include <vector>
 #include "kls/thread/TSS.h"
 #include "kls/thread/SpinLock.h"
 
 namespace kls::thread::tss::detail {
+    // Shared by the owning Pointer and every slot bound to it, freed when the last of them lets go
+    struct Generation {
+        const Cleanup cleanup;
+        std::atomic<uint32_t> refs;
+
+        void acquire() noexcept { refs.fetch_add(1, std::memory_order_relaxed); }
+
+        void release() noexcept { if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this; }
+    };
+
     class Host {
     public:
         static auto& get() {
@@ -37,77 +50,156 @@ namespace kls::thread::tss::detail {
 
         class Context {
         public:
-            Context() noexcept { Host::get().register_context(this); }
+            Context() noexcept {
+                Host::get().register_context(this);
+                fast_slots = m_inline;
+            }
 
             ~Context() {
                 auto& host = Host::get();
-                while (!m_storage.empty()) {
-                    std::vector<void*> storage;
-                    storage.swap(m_storage);
-                    for (uint32_t key = 0, n = static_cast<uint32_t>(storage.size()); key < n; ++key) {
-                        if (const auto value = storage[key]; value) {
-                            if (const auto cleanup = host.m_cleanups[key]; cleanup) cleanup(value);
+                // Cleanup routines may set values again, keep going until everything is empty
+                for (;;) {
+                    kls::temp::vector<Slot> bound;
+                    {
+                        // Keys with owner bound cleanups may be swept by another thread concurrently
+                        std::lock_guard lock(host.m_mutex);
+                        for (auto& slot: m_inline) if (slot.generation) bound.push_back(std::exchange(slot, {}));
+                        for (auto& page: m_pages) {
+                            if (!page) continue;
+                            for (auto& slot: page->slots) if (slot.generation) bound.push_back(std::exchange(slot, {}));
                         }
                     }
+                    if (bound.empty()) break;
+                    for (auto& slot: bound) {
+                        if (slot.value && slot.generation->cleanup) slot.generation->cleanup(slot.value);
+                        slot.generation->release();
+                    }
                 }
+                fast_slots = nullptr;
                 host.unregister_context(this);
             }
 
-            [[nodiscard]] void* get_value(uint32_t key) const noexcept {
-                if (key < m_storage.size()) return m_storage[key]; else return nullptr;
+            [[nodiscard]] void* get_value(Key key) noexcept {
+                const auto slot = find(key.index);
+                if (!slot || slot->generation == key.generation) return slot ? slot->value : nullptr;
+                drop(*slot);
+                return nullptr;
+            }
+
+            void set_value(Key key, void* value) {
+                for (;;) {
+                    const auto slot = value ? &locate(key.index) : find(key.index);
+                    if (!slot) return;
+                    if (slot->generation == key.generation) {
+                        slot->value = value;
+                        return;
+                    }
+                    // drop() runs a user cleanup that may set keys itself, look the slot up again afterwards
+                    if (slot->generation) {
+                        drop(*slot);
+                        continue;
+                    }
+                    if (value) {
+                        key.generation->acquire();
+                        *slot = { value, key.generation };
+                    }
+                    return;
+                }
             }
 
-            void set_value(uint32_t key, void* value) {
-                if (key >= m_storage.size())
-                    m_storage.resize(key + 1, nullptr);
-                m_storage[key] = value;
+            // Cleans up and unbinds the value of a key that is being deleted
+            void drop_value(Key key) noexcept {
+                if (const auto slot = find(key.index); slot && slot->generation == key.generation) drop(*slot);
             }
 
         private:
             friend class Host;
 
+            // Keys past the inline slots live in fixed-size pages that are allocated the first time a key in
+            // their range is set and never move afterwards. A thread only pays for the pages it touches, and
+            // growing the directory copies page pointers rather than slots.
+            static constexpr uint32_t PageSlots = 64;
+
+            struct Page {
+                Slot slots[PageSlots]{};
+            };
+
             Context* m_prev{ nullptr }, * m_next{ nullptr };
-            std::vector<void*> m_storage;
+            Slot m_inline[inline_slots]{};
+            std::vector<std::unique_ptr<Page>> m_pages;
+
+            [[nodiscard]] Slot* find(uint32_t index) noexcept {
+                if (index < inline_slots) return &m_inline[index];
+                index -= inline_slots;
+                const auto page = index / PageSlots;
+                if (page < m_pages.size() && m_pages[page]) return &m_pages[page]->slots[index % PageSlots];
+                return nullptr;
+            }
+
+            Slot& locate(uint32_t index) {
+                if (index < inline_slots) return m_inline[index];
+                index -= inline_slots;
+                const auto page = index / PageSlots;
+                if (page >= m_pages.size() || !m_pages[page]) {
+                    // Sweeps of deleted keys walk our directory under the host lock
+                    auto fresh = std::make_unique<Page>();
+                    std::lock_guard lock(Host::get().m_mutex);
+                    if (page >= m_pages.size()) m_pages.resize(page + 1);
+                    m_pages[page] = std::move(fresh);
+                }
+                return m_pages[page]->slots[index % PageSlots];
+            }
+
+            // Lazily cleans up a value left behind by a deleted key and unbinds the slot
+            static void drop(Slot& slot) noexcept {
+                const auto [value, generation] = std::exchange(slot, {});
+                if (!generation) return;
+                if (value && generation->cleanup) generation->cleanup(value);
+                generation->release();
+            }
         };
 
-        uint32_t new_key(Cleanup cleanup) {
+        Key new_key(Cleanup cleanup) {
+            const auto generation = new Generation{ cleanup, 1 };
             std::lock_guard lock(m_mutex);
             // See if we can recycle some key
-            uint32_t key;
+            uint32_t index;
             if (!m_freed_keys.empty()) {
-                key = m_freed_keys.top();
+                index = m_freed_keys.top();
                 m_freed_keys.pop();
-                m_cleanups[key] = cleanup;
-            }
-            else {
-                key = static_cast<uint32_t>(m_cleanups.size());
-                m_cleanups.push_back(cleanup);
             }
-            return key;
+            else index = m_next_key++;
+            return { index, generation };
         }
 
-        void delete_key(uint32_t key) {
+        // Keys whose cleanup does not reference user state are retired in O(1), their remaining values are
+        // cleaned up when the owning thread touches the index again or exits. Cleanups bound to user state
+        // could outlive it that way, so those keys still sweep every thread eagerly.
+        void delete_key(Key key) {
+            const auto cleanup = key.generation->cleanup;
             std::unique_lock lock(m_mutex);
             kls::temp::vector<void*> storage;
-            const auto cleanup = m_cleanups[key];
-            m_cleanups[key] = { nullptr, nullptr };
-            for (auto it = m_head; it; it = it->m_next) {
-                if (it->m_storage.size() > key && it->m_storage[key] != nullptr) {
-                    if (cleanup) storage.push_back(it->m_storage[key]);
-                    it->m_storage[key] = nullptr;
+            if (cleanup.user) {
+                for (auto it = m_head; it; it = it->m_next) {
+                    if (const auto slot = it->find(key.index); slot && slot->generation == key.generation) {
+                        if (slot->value && cleanup) storage.push_back(slot->value);
+                        *slot = {};
+                        key.generation->release();
+                    }
                 }
             }
-            m_freed_keys.push(key);
+            m_freed_keys.push(key.index);
             lock.unlock();
 
             // Run cleanup routines while the lock is released
             for (auto& it : storage) cleanup(it);
+            key.generation->release();
         }
 
     private:
         SpinLock m_mutex;
         Context* m_head{ nullptr }, * m_tail{ nullptr };
-        std::vector<Cleanup> m_cleanups;
+        uint32_t m_next_key{ 0 };
         std::stack<uint32_t> m_freed_keys;
 
         Host() = default;
@@ -123,7 +215,7 @@ namespace kls::thread::tss::detail {
         void unregister_context(Context* p) noexcept {
             std::lock_guard lock(m_mutex);
             if (p->m_next) p->m_next->m_prev = p->m_prev; else m_tail = p->m_prev;
-            if (p->m_prev) p->m_next->m_prev = p->m_prev; else m_head = p->m_next;
+            if (p->m_prev) p->m_prev->m_next = p->m_next; else m_head = p->m_next;
         }
     };
 
@@ -132,14 +224,18 @@ namespace kls::thread::tss::detail {
         return context;
     }
 
-    uint32_t create(Cleanup callback) { return Host::get().new_key(callback); }
+    constinit thread_local Slot* fast_slots = nullptr;
+
+    Key create(Cleanup callback) { return Host::get().new_key(callback); }
 
-    void remove(uint32_t key) noexcept {
-        if (key == invalid_key) return;
+    void remove(Key key) noexcept {
+        if (key.index == invalid_key) return;
+        // The calling thread's value can be cleaned up right away without walking anyone else
+        if (fast_slots) context().drop_value(key);
         Host::get().delete_key(key);
     }
 
-    void* get(uint32_t key) noexcept { return context().get_value(key); }
+    void* get_slow(Key key) noexcept { return context().get_value(key); }
 
-    void set(uint32_t key, void* p) { context().set_value(key, p); }
+    void set(Key key, void* p) { context().set_value(key, p); }
 }
@@ -0,0 +1,240 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <mutex>
+#include <utility>
+#include "kls/thread/SpinWait.h"
+#include "kls/thread/ThreadPool.h"
+#include "kls/thread/WorkStealingDeque.h"
+
+namespace kls::thread {
+    struct alignas(CacheLineSize) ThreadPool::Worker {
+        ThreadPool& pool;
+        WorkStealingDeque<Task*> deque{};
+        // Written only by the owning worker, summed up by wait_idle()
+        std::atomic<uint64_t> submitted{ 0 }, completed{ 0 };
+        uint64_t seed;
+        std::thread thread{};
+
+        Worker(ThreadPool& pool, uint64_t seed) noexcept: pool(pool), seed(seed) {}
+
+        // xorshift64, only used to pick steal victims
+        uint64_t next_random() noexcept {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            return seed;
+        }
+    };
+
+    ThreadPool::Worker*& ThreadPool::current() noexcept {
+        static thread_local Worker* worker = nullptr;
+        return worker;
+    }
+
+    namespace {
+        void bump(std::atomic<uint64_t>& counter) noexcept {
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+    }
+
+    ThreadPool::ThreadPool(unsigned int workers) {
+        if (!workers) workers = 1;
+        for (unsigned int i = 0; i < workers; ++i) {
+            m_workers.push_back(std::make_unique<Worker>(*this, 0x9E3779B97F4A7C15ull * (i + 1)));
+        }
+        for (auto& worker: m_workers) {
+            worker->thread = std::thread([this, w = worker.get()]() noexcept { run_worker(*w); });
+        }
+    }
+
+    ThreadPool::~ThreadPool() noexcept {
+        m_stop.store(true, std::memory_order_seq_cst);
+        wake(size());
+        for (auto& worker: m_workers) worker->thread.join();
+    }
+
+    void ThreadPool::enqueue(Task* task, unsigned int wakes) {
+        if (const auto self = current(); self && &self->pool == this) {
+            bump(self->submitted);
+            self->deque.push(task);
+            // A searching worker will find the task on its own
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (wakes > 1 || !m_searching.load(std::memory_order_relaxed)) wake(wakes);
+            return;
+        }
+        m_external_submitted.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard lock(m_inject_lock);
+            m_injected.push_back(task);
+            m_injected_size.fetch_add(1, std::memory_order_release);
+        }
+        wake(wakes);
+    }
+
+    void ThreadPool::wait(Join& join) noexcept {
+        if (const auto self = current(); self && &self->pool == this) {
+            // Help out instead of blocking a worker
+            SpinWait spinner{};
+            while (!join.finished()) {
+                if (const auto task = find_task(*self); task) {
+                    execute(*self, task);
+                    spinner.reset();
+                }
+                else spinner.once();
+            }
+            return;
+        }
+        SpinWait spinner{};
+        while (!spinner.will_yield()) {
+            if (join.finished()) return;
+            spinner.once();
+        }
+        for (;;) {
+            const auto state = join.m_state.fetch_or(Join::SleepingBit, std::memory_order_acq_rel);
+            if (!(state & Join::CountMask)) return;
+            futex::wait(join.m_state, state | Join::SleepingBit);
+        }
+    }
+
+    void ThreadPool::wait_idle() noexcept {
+        SpinWait spinner{};
+        while (!spinner.will_yield()) {
+            if (quiescent()) return;
+            spinner.once();
+        }
+        // A quiescent pool runs out of work, so the worker parking after the last task bumps the epoch
+        for (;;) {
+            const auto epoch = m_idle_epoch.load(std::memory_order_acquire);
+            m_idle_waiters.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const auto done = quiescent();
+            if (!done) futex::wait(m_idle_epoch, epoch);
+            m_idle_waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (done) return;
+        }
+    }
+
+    void ThreadPool::run_worker(Worker& self) noexcept {
+        current() = &self;
+        for (;;) {
+            auto task = find_task(self);
+            if (!task) {
+                m_searching.fetch_add(1, std::memory_order_seq_cst);
+                SpinWait spinner{};
+                while (!(task = find_task(self)) && !spinner.will_yield()) spinner.once();
+                m_searching.fetch_sub(1, std::memory_order_seq_cst);
+                if (!task) {
+                    if (m_stop.load(std::memory_order_acquire) && !has_work()) break;
+                    park();
+                    continue;
+                }
+                // We were the one finding work, make sure that whatever is left gets picked up as well
+                if (has_work()) wake(1);
+            }
+            execute(self, task);
+        }
+        current() = nullptr;
+    }
+
+    ThreadPool::Task* ThreadPool::find_task(Worker& self) noexcept {
+        if (const auto task = self.deque.pop(); task) return *task;
+        if (m_injected_size.load(std::memory_order_acquire)) {
+            std::lock_guard lock(m_inject_lock);
+            if (!m_injected.empty()) {
+                const auto task = m_injected.front();
+                m_injected.pop_front();
+                m_injected_size.fetch_sub(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+        const auto count = m_workers.size();
+        const auto start = static_cast<std::size_t>(self.next_random() % count);
+        for (std::size_t i = 0; i < count; ++i) {
+            auto& victim = *m_workers[(start + i) % count];
+            if (&victim == &self) continue;
+            if (const auto task = victim.deque.steal(); task) return *task;
+        }
+        return nullptr;
+    }
+
+    void ThreadPool::execute(Worker& self, Task* task) noexcept {
+        if (const auto bits = reinterpret_cast<uintptr_t>(task); bits & HandleTag)
+            std::coroutine_handle<>::from_address(reinterpret_cast<void*>(bits & ~HandleTag)).resume();
+        else {
+            task->run();
+            delete task;
+        }
+        bump(self.completed);
+    }
+
+    bool ThreadPool::has_work() const noexcept {
+        if (m_injected_size.load(std::memory_order_acquire)) return true;
+        for (auto& worker: m_workers) if (!worker->deque.empty()) return true;
+        return false;
+    }
+
+    // Double collect over the monotonic per-worker counters: if nothing moved in between, the sums were
+    // consistent at one instant and every task submitted so far had completed
+    bool ThreadPool::quiescent() const noexcept {
+        const auto collect = [this]() noexcept {
+            auto submitted = m_external_submitted.load(std::memory_order_acquire);
+            uint64_t completed = 0;
+            for (auto& worker: m_workers) {
+                submitted += worker->submitted.load(std::memory_order_acquire);
+                completed += worker->completed.load(std::memory_order_acquire);
+            }
+            return std::pair{ submitted, completed };
+        };
+        const auto first = collect();
+        return first.first == first.second && collect() == first;
+    }
+
+    void ThreadPool::park() noexcept {
+        m_sleepers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_idle_waiters.load(std::memory_order_relaxed)) {
+            m_idle_epoch.fetch_add(1, std::memory_order_release);
+            futex::wake_all(m_idle_epoch);
+        }
+        if (has_work() || m_stop.load(std::memory_order_relaxed)) {
+            // Take ourselves off the sleeper count, unless a waker has claimed us already
+            auto sleepers = m_sleepers.load(std::memory_order_relaxed);
+            while (sleepers) {
+                if (m_sleepers.compare_exchange_weak(sleepers, sleepers - 1, std::memory_order_relaxed)) return;
+            }
+        }
+        m_sleep.wait();
+    }
+
+    void ThreadPool::wake(unsigned int count) noexcept {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto sleepers = m_sleepers.load(std::memory_order_relaxed);
+        while (sleepers && count) {
+            const auto take = sleepers < count ? sleepers : count;
+            if (m_sleepers.compare_exchange_weak(sleepers, sleepers - take, std::memory_order_relaxed)) {
+                m_sleep.signal(take);
+                return;
+            }
+        }
+    }
+}
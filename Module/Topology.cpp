@@ -0,0 +1,202 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <set>
+#include <thread>
+#include <string>
+#include <utility>
+#include <fstream>
+#include <algorithm>
+#include "kls/thread/Topology.h"
+
+#if __has_include(<sched.h>) && defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#define KLS_THREAD_LINUX_TOPOLOGY
+#endif
+
+namespace {
+    [[maybe_unused]] bool read_unsigned(const std::string& path, unsigned int& value) noexcept {
+        std::ifstream file(path);
+        return static_cast<bool>(file >> value);
+    }
+
+    // Parses the kernel's cpulist format, e.g. "0-3,8,10-11"
+    [[maybe_unused]] std::vector<unsigned int> parse_list(const std::string& list) {
+        std::vector<unsigned int> result{};
+        std::size_t pos = 0;
+        while (pos < list.size()) {
+            std::size_t used;
+            const auto first = static_cast<unsigned int>(std::stoul(list.substr(pos), &used));
+            auto last = first;
+            pos += used;
+            if (pos < list.size() && list[pos] == '-') {
+                last = static_cast<unsigned int>(std::stoul(list.substr(pos + 1), &used));
+                pos += used + 1;
+            }
+            for (auto i = first; i <= last; ++i) result.push_back(i);
+            while (pos < list.size() && (list[pos] == ',' || list[pos] == '\n')) ++pos;
+        }
+        return result;
+    }
+
+    // CPUs worth of the CFS bandwidth quota of our cgroup (v2 cpu.max or v1 cfs_quota_us), 0 if unlimited
+    [[maybe_unused]] unsigned int cgroup_quota() noexcept {
+        try {
+            std::ifstream self("/proc/self/cgroup");
+            std::string line, v2 = "/", v1 = "/";
+            while (std::getline(self, line)) {
+                const auto first = line.find(':'), second = line.find(':', first + 1);
+                if (first == std::string::npos || second == std::string::npos) continue;
+                const auto controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+                const auto path = line.substr(second + 1);
+                if (controllers == ",,") v2 = path;
+                else if (controllers.find(",cpu,") != std::string::npos) v1 = path;
+            }
+            const auto ceil_div = [](double quota, double period) {
+                return quota > 0 && period > 0 ? static_cast<unsigned int>((quota + period - 1) / period) : 0u;
+            };
+            for (const auto& dir: { "/sys/fs/cgroup" + v2, std::string("/sys/fs/cgroup") }) {
+                std::ifstream max(dir + "/cpu.max");
+                std::string quota;
+                double period;
+                if (max >> quota >> period) return quota == "max" ? 0 : ceil_div(std::stod(quota), period);
+            }
+            for (const auto& dir: { "/sys/fs/cgroup/cpu" + v1, std::string("/sys/fs/cgroup/cpu"),
+                                    "/sys/fs/cgroup/cpu,cpuacct" + v1 }) {
+                std::ifstream quota_file(dir + "/cpu.cfs_quota_us"), period_file(dir + "/cpu.cfs_period_us");
+                double quota, period;
+                if (quota_file >> quota && period_file >> period) return ceil_div(quota, period);
+            }
+        }
+        catch (...) {}
+        return 0;
+    }
+}
+
+namespace kls::thread {
+    const Topology& Topology::get() noexcept {
+        static const Topology topology{};
+        return topology;
+    }
+
+    unsigned int Topology::node_of(unsigned int cpu) const noexcept {
+        const auto it = std::lower_bound(
+                m_cpus.begin(), m_cpus.end(), cpu, [](const Cpu& c, unsigned int id) { return c.id < id; }
+        );
+        return it != m_cpus.end() && it->id == cpu ? it->node : 0;
+    }
+
+#ifdef KLS_THREAD_LINUX_TOPOLOGY
+    Topology::Topology() noexcept {
+        try {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+                for (unsigned int i = 0; i < CPU_SETSIZE; ++i) if (CPU_ISSET(i, &set)) m_cpus.push_back({ i, i, 0, 0 });
+            }
+            for (auto& cpu: m_cpus) {
+                const auto base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu.id) + "/topology/";
+                read_unsigned(base + "core_id", cpu.core);
+                read_unsigned(base + "physical_package_id", cpu.package);
+            }
+            std::set<unsigned int> nodes{};
+            std::ifstream online("/sys/devices/system/node/online");
+            std::string online_list;
+            if (!std::getline(online, online_list)) online_list.clear();
+            for (const auto node: parse_list(online_list)) {
+                std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                std::string list;
+                if (!std::getline(file, list)) continue;
+                for (const auto id: parse_list(list)) {
+                    for (auto& cpu: m_cpus) if (cpu.id == id) cpu.node = node;
+                }
+            }
+            std::set<std::pair<unsigned int, unsigned int>> cores{};
+            for (auto& cpu: m_cpus) {
+                cores.emplace(cpu.package, cpu.core);
+                nodes.insert(cpu.node);
+            }
+            if (!cores.empty()) m_cores = static_cast<unsigned int>(cores.size());
+            if (!nodes.empty()) m_nodes = static_cast<unsigned int>(nodes.size());
+        }
+        catch (...) {
+            m_cpus.clear();
+        }
+        if (m_cpus.empty()) {
+            const auto count = std::max(std::thread::hardware_concurrency(), 1u);
+            for (unsigned int i = 0; i < count; ++i) m_cpus.push_back({ i, i, 0, 0 });
+            m_cores = count;
+        }
+        m_concurrency = static_cast<unsigned int>(m_cpus.size());
+        if (const auto quota = cgroup_quota(); quota && quota < m_concurrency) m_concurrency = quota;
+    }
+
+    unsigned int Topology::current_cpu() noexcept {
+        const auto cpu = sched_getcpu();
+        return cpu < 0 ? 0 : static_cast<unsigned int>(cpu);
+    }
+
+    namespace {
+        template<class Filter>
+        bool pin(const std::vector<Topology::Cpu>& cpus, Filter filter) noexcept {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            auto any = false;
+            for (auto& cpu: cpus) {
+                if (!filter(cpu)) continue;
+                CPU_SET(cpu.id, &set);
+                any = true;
+            }
+            return any && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+        }
+    }
+
+    bool Topology::pin_current_thread(unsigned int cpu) const noexcept {
+        return pin(m_cpus, [cpu](const Cpu& it) { return it.id == cpu; });
+    }
+
+    bool Topology::pin_current_thread_to_node(unsigned int node) const noexcept {
+        return pin(m_cpus, [node](const Cpu& it) { return it.node == node; });
+    }
+
+    bool Topology::unpin_current_thread() const noexcept {
+        return pin(m_cpus, [](const Cpu&) { return true; });
+    }
+#else
+    Topology::Topology() noexcept {
+        m_concurrency = m_cores = std::max(std::thread::hardware_concurrency(), 1u);
+        try {
+            for (unsigned int i = 0; i < m_concurrency; ++i) m_cpus.push_back({ i, i, 0, 0 });
+        }
+        catch (...) {}
+    }
+
+    unsigned int Topology::current_cpu() noexcept { return 0; }
+
+    bool Topology::pin_current_thread(unsigned int) const noexcept { return false; }
+
+    bool Topology::pin_current_thread_to_node(unsigned int) const noexcept { return false; }
+
+    bool Topology::unpin_current_thread() const noexcept { return false; }
+#endif
+}
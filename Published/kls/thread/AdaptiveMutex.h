@@ -0,0 +1,89 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "Futex.h"
+#include "SpinWait.h"
+#include "LockStats.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Spin-then-park mutex. A contended lock() first spins for a time budget that tracks how long recent
+    // contended acquisitions had to wait, see SpinBudget, and then parks on a futex.
+    // unlock() only enters the kernel when the lock word says a thread may be parked.
+    template<class Stats = stats::Disabled>
+    class BasicAdaptiveMutex: public AddressSensitive {
+    public:
+        void lock() noexcept {
+            if (try_acquire()) {
+                mStats.acquired();
+                return;
+            }
+            const auto since = mStats.contended();
+            mStats.acquired(since, lock_contended());
+        }
+
+        bool try_lock() noexcept {
+            if (!try_acquire()) return false;
+            mStats.acquired();
+            return true;
+        }
+
+        void unlock() noexcept {
+            mStats.released();
+            if (mState.exchange(Unlocked, std::memory_order_release) == Contended) futex::wake(mState, 1);
+        }
+
+    private:
+        static constexpr uint32_t Unlocked = 0, Locked = 1, Contended = 2;
+
+        std::atomic<uint32_t> mState = { Unlocked };
+        SpinBudget mBudget{};
+        [[no_unique_address]] Stats mStats{};
+
+        bool try_acquire() noexcept {
+            auto expect = Unlocked;
+            return mState.compare_exchange_strong(expect, Locked, std::memory_order_acquire, std::memory_order_relaxed);
+        }
+
+        // Returns the number of spin iterations it took
+        unsigned int lock_contended() noexcept {
+            AdaptiveSpinWait spinner{ mBudget };
+            while (spinner.spinning()) {
+                if (mState.load(std::memory_order_relaxed) == Unlocked && try_acquire()) {
+                    spinner.complete();
+                    return spinner.count();
+                }
+                spinner.once();
+            }
+            // Mark the lock as contended before parking so that the holder knows to wake us up
+            while (mState.exchange(Contended, std::memory_order_acquire) != Unlocked) futex::wait(mState, Contended);
+            spinner.complete();
+            return spinner.count();
+        }
+    };
+
+    using AdaptiveMutex = BasicAdaptiveMutex<>;
+}
@@ -0,0 +1,95 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include "Executor.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Manual reset event for coroutines. co_await suspends until set() is called, set() resumes every waiter
+    // and lets later ones through until reset(). The state word is either this (set), null (not set, nobody
+    // waiting) or the head of an intrusive lock-free stack of the suspended awaiters.
+    class AsyncEvent: public AddressSensitive {
+        class Awaiter;
+    public:
+        explicit AsyncEvent(bool set = false, Executor* executor = nullptr) noexcept:
+                m_state(set ? this : nullptr), m_executor(executor) {}
+
+        [[nodiscard]] bool is_set() const noexcept { return m_state.load(std::memory_order_acquire) == this; }
+
+        void set() noexcept {
+            auto waiters = static_cast<Awaiter*>(m_state.exchange(this, std::memory_order_acq_rel));
+            if (waiters == static_cast<void*>(this)) return;
+            while (waiters) {
+                // Read next before resuming, the awaiter lives in the frame of the coroutine
+                const auto next = waiters->m_next;
+                detail::resume_on(m_executor, waiters->m_handle);
+                waiters = next;
+            }
+        }
+
+        void reset() noexcept {
+            void* expect = this;
+            m_state.compare_exchange_strong(expect, nullptr, std::memory_order_relaxed);
+        }
+
+        Awaiter operator co_await() const noexcept;
+
+    private:
+        class Awaiter {
+        public:
+            explicit Awaiter(const AsyncEvent& event) noexcept: m_event(event) {}
+
+            [[nodiscard]] bool await_ready() const noexcept { return m_event.is_set(); }
+
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                m_handle = handle;
+                const void* const set = &m_event;
+                auto state = m_event.m_state.load(std::memory_order_acquire);
+                do {
+                    if (state == set) return false;
+                    m_next = static_cast<Awaiter*>(state);
+                } while (!m_event.m_state.compare_exchange_weak(
+                        state, this, std::memory_order_release, std::memory_order_acquire
+                ));
+                return true;
+            }
+
+            void await_resume() const noexcept {}
+
+        private:
+            friend class AsyncEvent;
+
+            const AsyncEvent& m_event;
+            Awaiter* m_next = nullptr;
+            std::coroutine_handle<> m_handle{};
+        };
+
+        mutable std::atomic<void*> m_state;
+        Executor* const m_executor;
+    };
+
+    inline AsyncEvent::Awaiter AsyncEvent::operator co_await() const noexcept { return Awaiter(*this); }
+}
@@ -0,0 +1,150 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <coroutine>
+#include "Executor.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Mutex for coroutines, a suspended waiter does not occupy a thread. The state word is NotLocked,
+    // LockedNoWaiters or the head of an intrusive lock-free stack of awaiters that arrived while the mutex
+    // was held. The holder reverses that stack into a private FIFO list on unlock() and hands the mutex
+    // directly to the first awaiter in it, so waiters are served in arrival order per batch.
+    //
+    //     auto lock = co_await mutex.scoped_lock();
+    class AsyncMutex: public AddressSensitive {
+        class LockAwaiter;
+        class ScopedLockAwaiter;
+    public:
+        class ScopedLock {
+        public:
+            ScopedLock(const ScopedLock&) = delete;
+
+            ScopedLock& operator=(const ScopedLock&) = delete;
+
+            ScopedLock(ScopedLock&& other) noexcept: m_mutex(other.m_mutex) { other.m_mutex = nullptr; }
+
+            ~ScopedLock() noexcept { if (m_mutex) m_mutex->unlock(); }
+
+        private:
+            friend class AsyncMutex;
+
+            explicit ScopedLock(AsyncMutex& mutex) noexcept: m_mutex(&mutex) {}
+
+            AsyncMutex* m_mutex;
+        };
+
+        explicit AsyncMutex(Executor* executor = nullptr) noexcept: m_executor(executor) {}
+
+        // co_await mutex.lock() leaves the caller responsible for unlock()
+        LockAwaiter lock() noexcept;
+
+        ScopedLockAwaiter scoped_lock() noexcept;
+
+        bool try_lock() noexcept {
+            auto expect = NotLocked;
+            return m_state.compare_exchange_strong(
+                    expect, LockedNoWaiters, std::memory_order_acquire, std::memory_order_relaxed
+            );
+        }
+
+        void unlock() noexcept {
+            auto head = m_waiters;
+            if (!head) {
+                auto expect = LockedNoWaiters;
+                if (m_state.compare_exchange_strong(expect, NotLocked, std::memory_order_release, std::memory_order_relaxed))
+                    return;
+                // Take the whole stack and reverse it into arrival order
+                auto stack = reinterpret_cast<LockAwaiter*>(m_state.exchange(LockedNoWaiters, std::memory_order_acquire));
+                while (stack) {
+                    const auto next = stack->m_next;
+                    stack->m_next = head;
+                    head = stack;
+                    stack = next;
+                }
+            }
+            // The mutex stays locked and passes to the first waiter
+            m_waiters = head->m_next;
+            detail::resume_on(m_executor, head->m_handle);
+        }
+
+    private:
+        static constexpr uintptr_t NotLocked = 1, LockedNoWaiters = 0;
+
+        class LockAwaiter {
+        public:
+            explicit LockAwaiter(AsyncMutex& mutex) noexcept: m_mutex(mutex) {}
+
+            [[nodiscard]] bool await_ready() const noexcept { return m_mutex.try_lock(); }
+
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                m_handle = handle;
+                auto state = m_mutex.m_state.load(std::memory_order_acquire);
+                for (;;) {
+                    if (state == NotLocked) {
+                        if (m_mutex.m_state.compare_exchange_weak(
+                                state, LockedNoWaiters, std::memory_order_acquire, std::memory_order_relaxed
+                        ))
+                            return false;
+                        continue;
+                    }
+                    m_next = reinterpret_cast<LockAwaiter*>(state);
+                    if (m_mutex.m_state.compare_exchange_weak(
+                            state, reinterpret_cast<uintptr_t>(this), std::memory_order_release, std::memory_order_relaxed
+                    ))
+                        return true;
+                }
+            }
+
+            void await_resume() const noexcept {}
+
+        protected:
+            AsyncMutex& m_mutex;
+
+        private:
+            friend class AsyncMutex;
+
+            LockAwaiter* m_next = nullptr;
+            std::coroutine_handle<> m_handle{};
+        };
+
+        class ScopedLockAwaiter: public LockAwaiter {
+        public:
+            using LockAwaiter::LockAwaiter;
+
+            [[nodiscard]] ScopedLock await_resume() const noexcept { return ScopedLock(m_mutex); }
+        };
+
+        std::atomic<uintptr_t> m_state{ NotLocked };
+        // Waiters already taken off the stack, only touched by the holder
+        LockAwaiter* m_waiters = nullptr;
+        Executor* const m_executor;
+    };
+
+    inline AsyncMutex::LockAwaiter AsyncMutex::lock() noexcept { return LockAwaiter(*this); }
+
+    inline AsyncMutex::ScopedLockAwaiter AsyncMutex::scoped_lock() noexcept { return ScopedLockAwaiter(*this); }
+}
@@ -0,0 +1,160 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <coroutine>
+#include "Executor.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Counting semaphore for coroutines. The state word either holds the available units, tagged with the
+    // low bit, or is the head of an intrusive lock-free stack of suspended awaiters while no unit is left.
+    // release() takes the stack over as a whole, so concurrent releasers never race on its nodes, hands its
+    // units to the awaiters it took and pushes the ones it could not serve back. Waiters are not served in
+    // any particular order.
+    //
+    //     co_await semaphore.acquire();
+    class AsyncSemaphore: public AddressSensitive {
+        class Awaiter;
+    public:
+        explicit AsyncSemaphore(std::size_t initial = 0, Executor* executor = nullptr) noexcept:
+                m_state(units(initial)), m_executor(executor) {}
+
+        Awaiter acquire() noexcept;
+
+        bool try_acquire() noexcept {
+            auto state = m_state.load(std::memory_order_relaxed);
+            while (is_units(state) && state != Empty) {
+                if (m_state.compare_exchange_weak(state, state - 2, std::memory_order_acquire, std::memory_order_relaxed))
+                    return true;
+            }
+            return false;
+        }
+
+        void release(std::size_t count = 1) noexcept;
+
+    private:
+        // count units are stored as (count << 1) | UnitsTag, awaiters are at least two byte aligned
+        static constexpr uintptr_t UnitsTag = 1, Empty = UnitsTag;
+
+        static constexpr uintptr_t units(std::size_t count) noexcept { return (count << 1) | UnitsTag; }
+
+        static constexpr bool is_units(uintptr_t state) noexcept { return state & UnitsTag; }
+
+        class Awaiter {
+        public:
+            explicit Awaiter(AsyncSemaphore& semaphore) noexcept: m_semaphore(semaphore) {}
+
+            [[nodiscard]] bool await_ready() const noexcept { return m_semaphore.try_acquire(); }
+
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                m_handle = handle;
+                auto& state = m_semaphore.m_state;
+                auto current = state.load(std::memory_order_acquire);
+                for (;;) {
+                    if (is_units(current) && current != Empty) {
+                        if (state.compare_exchange_weak(current, current - 2, std::memory_order_acquire, std::memory_order_relaxed))
+                            return false;
+                        continue;
+                    }
+                    m_next = is_units(current) ? nullptr : reinterpret_cast<Awaiter*>(current);
+                    if (state.compare_exchange_weak(
+                            current, reinterpret_cast<uintptr_t>(this), std::memory_order_release, std::memory_order_acquire
+                    ))
+                        return true;
+                }
+            }
+
+            void await_resume() const noexcept {}
+
+        private:
+            friend class AsyncSemaphore;
+
+            AsyncSemaphore& m_semaphore;
+            Awaiter* m_next = nullptr;
+            std::coroutine_handle<> m_handle{};
+        };
+
+        std::atomic<uintptr_t> m_state;
+        Executor* const m_executor;
+    };
+
+    inline AsyncSemaphore::Awaiter AsyncSemaphore::acquire() noexcept { return Awaiter(*this); }
+
+    inline void AsyncSemaphore::release(std::size_t count) noexcept {
+        Awaiter* taken = nullptr; // awaiters we own but have no unit for yet
+        Awaiter* last = nullptr; // the end of taken, found once when the stack is taken over
+        Awaiter* woken = nullptr;
+        auto state = m_state.load(std::memory_order_relaxed);
+        for (;;) {
+            while (count && taken) {
+                const auto next = taken->m_next;
+                taken->m_next = woken;
+                woken = taken;
+                taken = next;
+                --count;
+            }
+            if (!taken) last = nullptr;
+            if (is_units(state)) {
+                if (!taken) {
+                    if (m_state.compare_exchange_weak(state, state + (count << 1), std::memory_order_release, std::memory_order_relaxed))
+                        break;
+                    continue;
+                }
+                // Units released by somebody else while we held awaiters go to them
+                if (state != Empty) {
+                    if (m_state.compare_exchange_weak(state, Empty, std::memory_order_acquire, std::memory_order_relaxed)) {
+                        count = state >> 1;
+                        state = Empty;
+                    }
+                    continue;
+                }
+            }
+            else if (count) {
+                // count is only left over once taken ran dry, so the stack becomes all of it
+                if (m_state.compare_exchange_weak(state, Empty, std::memory_order_acquire, std::memory_order_relaxed)) {
+                    taken = last = reinterpret_cast<Awaiter*>(state);
+                    while (last->m_next) last = last->m_next;
+                    state = Empty;
+                }
+                continue;
+            }
+            if (!taken) break;
+            // Out of units with awaiters left, put them back in front of whoever queued meanwhile. Only the
+            // link at our end is rewritten on each attempt, walking again would follow the stack we saw last
+            // time into itself.
+            last->m_next = is_units(state) ? nullptr : reinterpret_cast<Awaiter*>(state);
+            if (m_state.compare_exchange_weak(state, reinterpret_cast<uintptr_t>(taken), std::memory_order_release, std::memory_order_relaxed))
+                break;
+            last->m_next = nullptr;
+        }
+        while (woken) {
+            const auto next = woken->m_next;
+            detail::resume_on(m_executor, woken->m_handle);
+            woken = next;
+        }
+    }
+}
@@ -0,0 +1,113 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include "SpinWait.h"
+#include "CacheLine.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Arrival tree shared by every Barrier. Arrivals combine pairwise in a tree of cache-line-sized nodes:
+    // the first of a pair to reach a node stops there, the second carries on to the next level, and the one
+    // reaching the top is the last arrival of the phase. Threads start at a leaf picked by a per-thread
+    // ordinal and probe onwards if it is taken. A level with an odd number of arrivals gets a node that
+    // starts half full. Node states are tagged with the phase, so nothing has to be reset between phases.
+    class BarrierBase: public AddressSensitive {
+    protected:
+        explicit BarrierBase(uint32_t expected);
+
+        // Stores the phase the caller arrived in and returns true for the last arrival
+        bool arrive(uint32_t& phase) noexcept;
+
+        // Called by the last arrival, publishes the next phase and wakes the waiters
+        void complete(uint32_t phase) noexcept;
+
+        void wait(uint32_t phase) noexcept;
+
+        // Takes effect from the next phase on
+        void drop() noexcept { m_drops.fetch_add(1, std::memory_order_relaxed); }
+
+    private:
+        struct alignas(CacheLineSize) Node {
+            std::atomic<uint32_t> state;
+        };
+
+        struct Level {
+            uint32_t first, count;
+            bool odd;
+        };
+
+        const std::unique_ptr<Node[]> m_nodes;
+        std::vector<Level> m_levels{};
+        uint32_t m_expected;
+        std::atomic<uint32_t> m_drops{ 0 };
+        alignas(CacheLineSize) std::atomic<uint32_t> m_phase{ 0 };
+        std::atomic<uint32_t> m_sleepers{ 0 };
+        SpinBudget m_budget{};
+
+        void shape(uint32_t phase);
+    };
+
+    struct NoCompletion {
+        void operator()() const noexcept {}
+    };
+
+    // Reusable barrier, the counterpart of std::barrier. The last arrival of a phase runs the completion
+    // function before anyone is released. Waiters spin with the adaptive budget of the barrier, which
+    // tracks the phase turnaround, and then sleep on a futex.
+    template<class Completion = NoCompletion>
+    class Barrier: public BarrierBase {
+    public:
+        using Token = uint32_t;
+
+        explicit Barrier(uint32_t expected, Completion completion = Completion{}) :
+                BarrierBase(expected), m_completion(std::move(completion)) {}
+
+        [[nodiscard]] Token arrive() noexcept {
+            uint32_t phase;
+            if (BarrierBase::arrive(phase)) {
+                m_completion();
+                complete(phase);
+            }
+            return phase;
+        }
+
+        void wait(Token token) noexcept { BarrierBase::wait(token); }
+
+        void arrive_and_wait() noexcept { wait(arrive()); }
+
+        // Arrives and leaves, the expected count of all later phases is one less
+        void arrive_and_drop() noexcept {
+            drop();
+            static_cast<void>(arrive());
+        }
+
+    private:
+        [[no_unique_address]] Completion m_completion;
+    };
+}
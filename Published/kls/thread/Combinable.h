@@ -0,0 +1,166 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <type_traits>
+#include "TSS.h"
+#include "SpinLock.h"
+#include "CacheLine.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Per-thread copies of a value that are updated without any synchronization and reduced on demand.
+    // Each thread lazily gets its own cache-line-aligned copy through local(). combine() folds the copies of
+    // all live threads together with the values of exited threads, which are folded into a retired
+    // accumulator with Reduce when they exit.
+    // Arithmetic copies are kept in a Cell that the owner updates with relaxed loads and stores, never with a
+    // read-modify-write, so combine() and for_each() may run while the owners keep counting. Other types are
+    // plain T and need their writers quiesced before they are read.
+    template<class T, class Reduce = std::plus<T>>
+    class Combinable: public AddressSensitive {
+    public:
+        // The calling thread's copy of an arithmetic T, only ever written by that thread
+        class Cell {
+        public:
+            Cell(T value) noexcept: m_value(value) {}
+
+            [[nodiscard]] T load() const noexcept { return m_value.load(std::memory_order_relaxed); }
+
+            void store(T value) noexcept { m_value.store(value, std::memory_order_relaxed); }
+
+            operator T() const noexcept { return load(); }
+
+            Cell& operator=(T value) noexcept {
+                store(value);
+                return *this;
+            }
+
+            Cell& operator+=(T value) noexcept {
+                store(load() + value);
+                return *this;
+            }
+
+            Cell& operator-=(T value) noexcept {
+                store(load() - value);
+                return *this;
+            }
+
+            Cell& operator++() noexcept { return *this += T(1); }
+
+            Cell& operator--() noexcept { return *this -= T(1); }
+
+            T operator++(int) noexcept {
+                const auto value = load();
+                store(value + T(1));
+                return value;
+            }
+
+            T operator--(int) noexcept {
+                const auto value = load();
+                store(value - T(1));
+                return value;
+            }
+
+        private:
+            std::atomic<T> m_value;
+        };
+
+        using Value = std::conditional_t<std::is_arithmetic_v<T>, Cell, T>;
+
+        explicit Combinable(T identity = T{}, Reduce reduce = Reduce{}) :
+                m_identity(identity), m_retired(identity), m_reduce(std::move(reduce)) {}
+
+        Value& local() {
+            if (const auto node = m_local.get(); node) return node->value;
+            return create_local();
+        }
+
+        template<class Op>
+        T combine(Op op) const {
+            std::lock_guard lock(m_lock);
+            T result = m_retired;
+            for (auto it = m_head; it; it = it->next) result = op(std::move(result), read(it->value));
+            return result;
+        }
+
+        T combine() const { return combine(m_reduce); }
+
+        // Visits the copies of the live threads, values of exited threads are only available through combine
+        template<class Fn>
+        void for_each(Fn fn) const {
+            std::lock_guard lock(m_lock);
+            for (auto it = m_head; it; it = it->next) fn(read(it->value));
+        }
+
+        void clear() {
+            std::lock_guard lock(m_lock);
+            m_retired = m_identity;
+            for (auto it = m_head; it; it = it->next) it->value = m_identity;
+        }
+
+    private:
+        struct alignas(CacheLineSize) Node {
+            Value value;
+            Node* prev, * next;
+        };
+
+        mutable SpinLock m_lock;
+        Node* m_head{ nullptr };
+        const T m_identity;
+        T m_retired;
+        Reduce m_reduce;
+        // Declared last so that deleting the key, which sweeps every thread's node, happens first
+        Pointer<Node, void> m_local{ &retire, this };
+
+        Value& create_local() {
+            const auto node = new Node{ m_identity, nullptr, nullptr };
+            {
+                std::lock_guard lock(m_lock);
+                if ((node->next = m_head)) m_head->prev = node;
+                m_head = node;
+            }
+            m_local.reset(node);
+            return node->value;
+        }
+
+        static decltype(auto) read(const Value& value) noexcept {
+            if constexpr (std::is_arithmetic_v<T>) return value.load(); else return value;
+        }
+
+        static void retire(void* p, void* user) noexcept {
+            const auto self = static_cast<Combinable*>(user);
+            const auto node = static_cast<Node*>(p);
+            if (!node) return;
+            {
+                std::lock_guard lock(self->m_lock);
+                if (node->next) node->next->prev = node->prev;
+                if (node->prev) node->prev->next = node->next; else self->m_head = node->next;
+                self->m_retired = self->m_reduce(std::move(self->m_retired), read(node->value));
+            }
+            delete node;
+        }
+    };
+}
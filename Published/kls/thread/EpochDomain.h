@@ -0,0 +1,142 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include "TSS.h"
+#include "SpinLock.h"
+#include "CacheLine.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Epoch based memory reclamation. Readers of a lock-free structure hold a Guard from enter() while they
+    // touch shared nodes, which costs a store and a fence on the outermost level. Writers unlink a node and
+    // retire() it into a per-thread bag of the current global epoch. The epoch only advances once every
+    // thread inside a guard has observed it, so a bag is freed, a batch at a time, two epochs later.
+    // Threads exiting with garbage left hand their bags over to the domain, where the next collect() of any
+    // other thread picks them up. A domain must outlive all guards and must not be destroyed while other
+    // threads still use it; whatever is still retired then is freed right away.
+    class EpochDomain: public AddressSensitive {
+        struct Record;
+    public:
+        class Guard {
+        public:
+            Guard(const Guard&) = delete;
+
+            Guard& operator=(const Guard&) = delete;
+
+            Guard(Guard&& other) noexcept: m_record(other.m_record) { other.m_record = nullptr; }
+
+            ~Guard() noexcept { if (m_record) exit(*m_record); }
+
+        private:
+            friend class EpochDomain;
+
+            explicit Guard(Record* record) noexcept: m_record(record) {}
+
+            Record* m_record;
+        };
+
+        // Guards nest, only the outermost one publishes the epoch
+        [[nodiscard]] Guard enter() noexcept {
+            auto& record = local();
+            if (!record.nesting++) {
+                record.state.store((m_epoch.load(std::memory_order_relaxed) << 1) | Active, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+            return Guard(&record);
+        }
+
+        template<class T>
+        void retire(T* p) { retire(p, [](void* p) noexcept { delete static_cast<T*>(p); }); }
+
+        // p must already be unreachable for threads entering from now on
+        void retire(void* p, void (* deleter)(void*) noexcept);
+
+        // Tries to advance the epoch and frees every bag of the caller and of exited threads that is old enough
+        void collect() noexcept;
+
+        // Process wide domain for structures that do not need their own, never destroyed
+        static EpochDomain& global() noexcept;
+
+    private:
+        static constexpr uint64_t Active = 1;
+        // Retirements between two attempts to advance the epoch
+        static constexpr unsigned int CollectEvery = 64;
+
+        struct Retired {
+            void* pointer;
+            void (* deleter)(void*) noexcept;
+        };
+
+        struct Bag {
+            uint64_t epoch = 0;
+            std::vector<Retired> items{};
+
+            void free() noexcept;
+        };
+
+        struct alignas(CacheLineSize) Record {
+            // (epoch << 1) | Active while inside a guard, 0 otherwise
+            std::atomic<uint64_t> state{ 0 };
+            unsigned int nesting = 0, retired = 0;
+            std::atomic_bool in_use{ true };
+            Record* next = nullptr;
+            Bag bags[3]{};
+        };
+
+        // Records are recycled but never freed before the domain, so the epoch scan needs no lock
+        struct Registry {
+            std::atomic<Record*> head{ nullptr };
+            std::atomic_bool has_orphans{ false };
+            SpinLock lock{};
+            std::vector<Bag> orphans{};
+
+            ~Registry() noexcept;
+        };
+
+        alignas(CacheLineSize) std::atomic<uint64_t> m_epoch{ 0 };
+        Registry m_registry{};
+        // Declared last, deleting the key hands the bags of all threads over to the registry first
+        Pointer<Record, void> m_local{ &release_record, this };
+
+        Record& local() noexcept {
+            if (const auto record = m_local.get(); record) return *record;
+            return acquire_record();
+        }
+
+        static void exit(Record& record) noexcept {
+            if (!--record.nesting) record.state.store(0, std::memory_order_release);
+        }
+
+        Record& acquire_record() noexcept;
+
+        static void release_record(void* p, void* user) noexcept;
+
+        bool try_advance() noexcept;
+
+        void collect(Record& record) noexcept;
+    };
+}
@@ -0,0 +1,94 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <cstdint>
+#include "Futex.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Lets a thread block until a condition of some lock-free structure becomes true without losing wake ups.
+    // The waiter announces itself with prepare_wait(), re-checks the condition, and then either backs out with
+    // cancel_wait() or sleeps with commit_wait(). The notifier changes the structure and calls notify_one() or
+    // notify_all(), which are a fence and a relaxed load when nobody is waiting.
+    // The waiter count and the epoch share one futex word: the low bits count the announced waiters, the high
+    // bits are bumped by every notify that finds a waiter, so a waiter that announced itself before the
+    // notify never goes to sleep on a stale epoch.
+    //
+    //     for (;;) {
+    //         if (try_pop(out)) break;
+    //         const auto key = event.prepare_wait();
+    //         if (try_pop(out)) { event.cancel_wait(); break; }
+    //         event.commit_wait(key);
+    //     }
+    class EventCount: public AddressSensitive {
+    public:
+        class Key {
+            friend class EventCount;
+
+            explicit Key(uint32_t epoch) noexcept: m_epoch(epoch) {}
+
+            uint32_t m_epoch;
+        };
+
+        Key prepare_wait() noexcept {
+            return Key(m_state.fetch_add(OneWaiter, std::memory_order_seq_cst) & EpochMask);
+        }
+
+        void cancel_wait() noexcept { m_state.fetch_sub(OneWaiter, std::memory_order_seq_cst); }
+
+        // May return spuriously, the caller has to re-check its condition either way
+        void commit_wait(Key key) noexcept {
+            for (;;) {
+                const auto state = m_state.load(std::memory_order_acquire);
+                if ((state & EpochMask) != key.m_epoch) break;
+                futex::wait(m_state, state);
+            }
+            m_state.fetch_sub(OneWaiter, std::memory_order_seq_cst);
+        }
+
+        void notify_one() noexcept { notify(1); }
+
+        void notify_all() noexcept { notify(std::numeric_limits<uint32_t>::max()); }
+
+        void notify(uint32_t count) noexcept {
+            // Orders the caller's update before the waiter check, pairs with the RMW in prepare_wait()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!(m_state.load(std::memory_order_relaxed) & WaiterMask)) return;
+            m_state.fetch_add(OneEpoch, std::memory_order_seq_cst);
+            if (count == std::numeric_limits<uint32_t>::max()) futex::wake_all(m_state);
+            else futex::wake(m_state, count);
+        }
+
+    private:
+        // 65535 concurrent waiters at most. The epoch wraps after 65536 notifies, a waiter would have to be
+        // stalled between prepare_wait() and the futex call for exactly that many of them to miss one.
+        static constexpr uint32_t WaiterBits = 16;
+        static constexpr uint32_t OneWaiter = 1, WaiterMask = (1u << WaiterBits) - 1;
+        static constexpr uint32_t OneEpoch = 1u << WaiterBits, EpochMask = ~WaiterMask;
+
+        std::atomic<uint32_t> m_state{ 0 };
+    };
+}
@@ -0,0 +1,160 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <utility>
+#include <optional>
+#include <exception>
+#include <type_traits>
+#include "TSS.h"
+#include "SpinLock.h"
+#include "SpinWait.h"
+#include "CacheLine.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Flat combining around a sequential data structure. A caller of apply() publishes its operation in its
+    // own cache-line-sized record and tries to take the lock. The winner becomes the combiner and runs the
+    // pending operations of all threads back to back while the structure stays in its cache, everybody else
+    // polls its own record with SpinWait until its operation is done or the lock frees up.
+    // Operations run on whichever thread combines; exceptions are passed back to the thread that asked.
+    template<class T>
+    class FlatCombiner: public AddressSensitive {
+    public:
+        template<class ...Ts>
+        explicit FlatCombiner(Ts&& ... args) : m_data(std::forward<Ts>(args)...) {}
+
+        // Runs fn(T&) with exclusive access to the structure and returns its result
+        template<class Fn>
+        std::invoke_result_t<Fn&, T&> apply(Fn&& fn) {
+            using Result = std::invoke_result_t<Fn&, T&>;
+            Operation<Fn, Result> operation{ fn };
+            auto& record = local();
+            record.pending.store(&operation, std::memory_order_release);
+            SpinWait spinner{};
+            while (record.pending.load(std::memory_order_acquire)) {
+                if (m_lock.try_lock()) {
+                    combine();
+                    m_lock.unlock();
+                }
+                else spinner.once();
+            }
+            if (operation.error) std::rethrow_exception(operation.error);
+            if constexpr (std::is_reference_v<Result>) return static_cast<Result>(**operation.result);
+            else if constexpr (!std::is_void_v<Result>) return std::move(*operation.result);
+        }
+
+    private:
+        class Request {
+        public:
+            virtual void run(T& data) noexcept = 0;
+
+        protected:
+            ~Request() = default;
+        };
+
+        template<class Fn, class Result>
+        class Operation final: public Request {
+        public:
+            explicit Operation(Fn& fn) noexcept: m_fn(fn) {}
+
+            void run(T& data) noexcept override {
+                try {
+                    if constexpr (std::is_void_v<Result>) m_fn(data);
+                    else if constexpr (std::is_reference_v<Result>) {
+                        auto&& value = m_fn(data);
+                        result.emplace(std::addressof(value));
+                    }
+                    else result.emplace(m_fn(data));
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+            }
+
+            // References are kept as pointers, optional cannot hold them
+            using Stored = std::conditional_t<std::is_reference_v<Result>, std::remove_reference_t<Result>*, Result>;
+
+            std::conditional_t<std::is_void_v<Result>, bool, std::optional<Stored>> result{};
+            std::exception_ptr error{};
+
+        private:
+            Fn& m_fn;
+        };
+
+        struct alignas(CacheLineSize) Record {
+            std::atomic<Request*> pending{ nullptr };
+            Record* prev = nullptr, * next = nullptr;
+        };
+
+        // A couple of passes pick up operations published while the first one ran
+        static constexpr int CombinePasses = 3;
+
+        SpinLock m_lock;
+        Record* m_head{ nullptr };
+        T m_data;
+        // Declared last so that deleting the key, which unlinks every thread's record, happens first
+        Pointer<Record, void> m_local{ &retire, this };
+
+        Record& local() {
+            if (const auto record = m_local.get(); record) return *record;
+            const auto record = new Record();
+            {
+                std::lock_guard lock(m_lock);
+                if ((record->next = m_head)) m_head->prev = record;
+                m_head = record;
+            }
+            m_local.reset(record);
+            return *record;
+        }
+
+        void combine() noexcept {
+            for (int pass = 0; pass < CombinePasses; ++pass) {
+                auto served = false;
+                for (auto it = m_head; it; it = it->next) {
+                    if (const auto request = it->pending.load(std::memory_order_acquire); request) {
+                        request->run(m_data);
+                        it->pending.store(nullptr, std::memory_order_release);
+                        served = true;
+                    }
+                }
+                if (!served) break;
+            }
+        }
+
+        static void retire(void* p, void* user) noexcept {
+            const auto self = static_cast<FlatCombiner*>(user);
+            const auto record = static_cast<Record*>(p);
+            if (!record) return;
+            {
+                std::lock_guard lock(self->m_lock);
+                if (record->next) record->next->prev = record->prev;
+                if (record->prev) record->prev->next = record->next; else self->m_head = record->next;
+            }
+            delete record;
+        }
+    };
+}
@@ -0,0 +1,50 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Address based wait/wake, the moral equivalent of a Linux futex. Backed by the futex syscall on Linux,
+// WaitOnAddress on Windows and a hashed table of condition variables anywhere else.
+// All waits may return spuriously, callers are expected to re-check their condition in a loop.
+namespace kls::thread::futex {
+    void wait(std::atomic<uint32_t>& word, uint32_t expect) noexcept;
+
+    // Returns false if and only if the timeout has elapsed
+    bool wait_for(std::atomic<uint32_t>& word, uint32_t expect, std::chrono::nanoseconds timeout) noexcept;
+
+    template<class Clock, class Duration>
+    bool wait_until(
+            std::atomic<uint32_t>& word, uint32_t expect, const std::chrono::time_point<Clock, Duration>& absTime
+    ) noexcept {
+        const auto now = Clock::now();
+        if (now >= absTime) return false;
+        return wait_for(word, expect, std::chrono::duration_cast<std::chrono::nanoseconds>(absTime - now));
+    }
+
+    void wake(std::atomic<uint32_t>& word, uint32_t count) noexcept;
+
+    void wake_all(std::atomic<uint32_t>& word) noexcept;
+}
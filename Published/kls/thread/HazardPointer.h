@@ -0,0 +1,135 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include "TSS.h"
+#include "SpinLock.h"
+#include "CacheLine.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Hazard pointer reclamation, the alternative to EpochDomain when a stalled reader must not hold back
+    // all garbage. A reader publishes the exact node it is about to dereference through protect(), and a
+    // retired node is only freed once no hazard slot of any thread points at it. Retired nodes are scanned
+    // in batches proportional to the number of slots, so freeing stays amortized O(1). Threads exiting with
+    // garbage left hand it over to the domain, the next scan of any thread takes it along.
+    class HazardDomain: public AddressSensitive {
+        struct Record;
+    public:
+        static constexpr unsigned int SlotsPerThread = 4;
+
+        // Owns one hazard slot of the calling thread. Holders must stay on the thread that created them.
+        class Holder {
+        public:
+            Holder(const Holder&) = delete;
+
+            Holder& operator=(const Holder&) = delete;
+
+            Holder(Holder&& other) noexcept: m_record(other.m_record), m_slot(other.m_slot) { other.m_record = nullptr; }
+
+            ~Holder() noexcept { if (m_record) release(); }
+
+            // Loads source until the published hazard is known to cover the value that was read
+            template<class T>
+            T* protect(const std::atomic<T*>& source) noexcept {
+                auto p = source.load(std::memory_order_relaxed);
+                for (;;) {
+                    hazard().store(p, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    const auto q = source.load(std::memory_order_acquire);
+                    if (q == p) return p;
+                    p = q;
+                }
+            }
+
+            void reset() noexcept { hazard().store(nullptr, std::memory_order_release); }
+
+        private:
+            friend class HazardDomain;
+
+            Holder(Record* record, unsigned int slot) noexcept: m_record(record), m_slot(slot) {}
+
+            std::atomic<const void*>& hazard() noexcept { return m_record->hazards[m_slot]; }
+
+            void release() noexcept;
+
+            Record* m_record;
+            unsigned int m_slot;
+        };
+
+        // Terminates if the calling thread already holds SlotsPerThread holders of this domain
+        [[nodiscard]] Holder make_holder() noexcept;
+
+        template<class T>
+        void retire(T* p) { retire(p, [](void* p) noexcept { delete static_cast<T*>(p); }); }
+
+        void retire(void* p, void (* deleter)(void*) noexcept);
+
+        // Frees every retired node of the caller and of exited threads that is not protected right now
+        void scan() noexcept;
+
+        static HazardDomain& global() noexcept;
+
+    private:
+        struct Retired {
+            void* pointer;
+            void (* deleter)(void*) noexcept;
+        };
+
+        struct alignas(CacheLineSize) Record {
+            std::atomic<const void*> hazards[SlotsPerThread]{};
+            unsigned int used = 0;
+            std::atomic_bool in_use{ true };
+            Record* next = nullptr;
+            std::vector<Retired> retired{};
+        };
+
+        struct Registry {
+            std::atomic<Record*> head{ nullptr };
+            std::atomic<uint32_t> records{ 0 };
+            std::atomic_bool has_orphans{ false };
+            SpinLock lock{};
+            std::vector<Retired> orphans{};
+
+            ~Registry() noexcept;
+        };
+
+        Registry m_registry{};
+        // Declared last, deleting the key hands the retired nodes of all threads over to the registry first
+        Pointer<Record, void> m_local{ &release_record, this };
+
+        Record& local() noexcept {
+            if (const auto record = m_local.get(); record) return *record;
+            return acquire_record();
+        }
+
+        Record& acquire_record() noexcept;
+
+        static void release_record(void* p, void* user) noexcept;
+
+        void scan(Record& record) noexcept;
+    };
+}
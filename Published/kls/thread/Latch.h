@@ -0,0 +1,72 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "Futex.h"
+#include "SpinWait.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Single-use countdown, the counterpart of std::latch. Waiters spin for a time budget that follows how
+    // long recent waits took and then sleep on the counter, count_down() only enters the kernel when
+    // someone is asleep.
+    class Latch: public AddressSensitive {
+    public:
+        explicit Latch(uint32_t expected) noexcept: m_count(expected) {}
+
+        void count_down(uint32_t n = 1) noexcept {
+            if (m_count.fetch_sub(n, std::memory_order_seq_cst) != n) return;
+            if (m_sleepers.load(std::memory_order_seq_cst)) futex::wake_all(m_count);
+        }
+
+        [[nodiscard]] bool try_wait() const noexcept { return !m_count.load(std::memory_order_acquire); }
+
+        void wait() noexcept {
+            AdaptiveSpinWait spinner{ m_budget };
+            while (spinner.spinning()) {
+                if (try_wait()) {
+                    spinner.complete();
+                    return;
+                }
+                spinner.once();
+            }
+            m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+            for (auto count = m_count.load(std::memory_order_seq_cst); count; count = m_count.load(std::memory_order_seq_cst))
+                futex::wait(m_count, count);
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+            spinner.complete();
+        }
+
+        void arrive_and_wait(uint32_t n = 1) noexcept {
+            count_down(n);
+            wait();
+        }
+
+    private:
+        std::atomic<uint32_t> m_count;
+        std::atomic<uint32_t> m_sleepers{ 0 };
+        SpinBudget m_budget{};
+    };
+}
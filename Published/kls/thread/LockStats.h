@@ -0,0 +1,144 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "kls/Object.h"
+
+// Compile-time selected contention instrumentation for the locks and semaphores of this module.
+// Every primitive takes a Stats policy parameter defaulting to stats::Disabled, whose hooks are empty
+// and compile away. stats::Enabled<"name"> aggregates the numbers of every primitive sharing that name
+// into one stats::Site, which can be read back with stats::Site::collect().
+namespace kls::thread::stats {
+    constexpr std::size_t HistogramBuckets = 40;
+
+    struct Snapshot {
+        const char* name;
+        uint64_t acquisitions; // successful acquisitions, contended or not
+        uint64_t contended; // acquisitions that had to wait
+        uint64_t spins; // SpinWait iterations spent waiting
+        uint64_t wait_ns; // total time spent waiting
+        uint64_t hold_ns; // total time exclusive holders kept the lock
+        std::array<uint64_t, HistogramBuckets> wait_histogram; // bucket i counts waits of [2^(i-1), 2^i) ns
+    };
+
+    class Site: public AddressSensitive {
+    public:
+        // Sites register themselves in a process wide list and have to stay alive until exit
+        explicit Site(const char* name) noexcept;
+
+        void record_acquire() noexcept { mAcquisitions.fetch_add(1, std::memory_order_relaxed); }
+
+        void record_contended(const uint64_t wait_ns, const unsigned int spins) noexcept {
+            mAcquisitions.fetch_add(1, std::memory_order_relaxed);
+            mContended.fetch_add(1, std::memory_order_relaxed);
+            mSpins.fetch_add(spins, std::memory_order_relaxed);
+            mWaitNs.fetch_add(wait_ns, std::memory_order_relaxed);
+            const auto bucket = static_cast<std::size_t>(std::bit_width(wait_ns));
+            mHistogram[bucket < HistogramBuckets ? bucket : HistogramBuckets - 1].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void record_hold(const uint64_t hold_ns) noexcept { mHoldNs.fetch_add(hold_ns, std::memory_order_relaxed); }
+
+        [[nodiscard]] Snapshot snapshot() const noexcept;
+
+        void reset() noexcept;
+
+        [[nodiscard]] static std::vector<Snapshot> collect();
+
+    private:
+        const char* mName;
+        Site* mNext;
+        std::atomic<uint64_t> mAcquisitions{ 0 }, mContended{ 0 }, mSpins{ 0 }, mWaitNs{ 0 }, mHoldNs{ 0 };
+        std::array<std::atomic<uint64_t>, HistogramBuckets> mHistogram{};
+    };
+
+    inline uint64_t now() noexcept {
+        using namespace std::chrono;
+        return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+    }
+
+    struct Disabled {
+        static constexpr bool IsEnabled = false;
+
+        void acquired() noexcept {}
+
+        uint64_t contended() noexcept { return 0; }
+
+        void acquired(uint64_t, unsigned int) noexcept {}
+
+        void acquired_shared() noexcept {}
+
+        void acquired_shared(uint64_t, unsigned int) noexcept {}
+
+        void released() noexcept {}
+    };
+
+    template<std::size_t N>
+    struct Name {
+        constexpr Name(const char (&str)[N]) noexcept { for (std::size_t i = 0; i < N; ++i) value[i] = str[i]; }
+
+        char value[N];
+    };
+
+    template<Name SiteName>
+    class Enabled {
+    public:
+        static constexpr bool IsEnabled = true;
+
+        static Site& site() noexcept {
+            static Site instance{ SiteName.value };
+            return instance;
+        }
+
+        void acquired() noexcept {
+            site().record_acquire();
+            mAcquiredAt = now();
+        }
+
+        uint64_t contended() noexcept { return now(); }
+
+        void acquired(const uint64_t since, const unsigned int spins) noexcept {
+            mAcquiredAt = now();
+            site().record_contended(mAcquiredAt - since, spins);
+        }
+
+        // Shared holders overlap each other, so only their acquisition is accounted for
+        void acquired_shared() noexcept { site().record_acquire(); }
+
+        void acquired_shared(const uint64_t since, const unsigned int spins) noexcept {
+            site().record_contended(now() - since, spins);
+        }
+
+        void released() noexcept { site().record_hold(now() - mAcquiredAt); }
+
+    private:
+        uint64_t mAcquiredAt = 0;
+    };
+}
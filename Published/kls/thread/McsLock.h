@@ -0,0 +1,120 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include "SpinWait.h"
+#include "CacheLine.h"
+#include "LockStats.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    class McsLockBase: public AddressSensitive {
+    public:
+        struct alignas(CacheLineSize) Node {
+            std::atomic<Node*> next;
+            std::atomic_bool locked;
+            Node* free_next;
+        };
+
+    protected:
+        static Node* acquire_node() noexcept;
+
+        static void release_node(Node* node) noexcept;
+
+        static unsigned int wait_for_lock(const Node* node) noexcept {
+            // Sleeping would stall every thread queued behind us, so only back off as far as a yield
+            SpinWait spinner{};
+            while (node->locked.load(std::memory_order_acquire)) {
+                spinner.once(std::numeric_limits<unsigned int>::max());
+            }
+            return spinner.count();
+        }
+
+        static Node* wait_for_successor(const Node* node) noexcept {
+            SpinWait spinner{};
+            for (;;) {
+                if (const auto next = node->next.load(std::memory_order_acquire); next) return next;
+                spinner.once(std::numeric_limits<unsigned int>::max());
+            }
+        }
+    };
+
+    // Mellor-Crummey and Scott queue lock. Every waiter spins on a node in its own cache line and the lock
+    // is handed over in FIFO order, so a release only touches the cache line of the next waiter.
+    // Nodes come from a per-thread cache, which keeps the plain lock()/unlock() interface.
+    template<class Stats = stats::Disabled>
+    class BasicMcsLock: public McsLockBase {
+    public:
+        void lock() noexcept {
+            const auto node = acquire_node();
+            node->next.store(nullptr, std::memory_order_relaxed);
+            node->locked.store(true, std::memory_order_relaxed);
+            if (const auto prev = mTail.exchange(node, std::memory_order_acq_rel); prev) {
+                const auto since = mStats.contended();
+                prev->next.store(node, std::memory_order_release);
+                mStats.acquired(since, wait_for_lock(node));
+            }
+            else mStats.acquired();
+            mHolder = node;
+        }
+
+        bool try_lock() noexcept {
+            const auto node = acquire_node();
+            node->next.store(nullptr, std::memory_order_relaxed);
+            Node* expect = nullptr;
+            if (mTail.compare_exchange_strong(expect, node, std::memory_order_acquire, std::memory_order_relaxed)) {
+                mStats.acquired();
+                mHolder = node;
+                return true;
+            }
+            release_node(node);
+            return false;
+        }
+
+        void unlock() noexcept {
+            mStats.released();
+            const auto node = mHolder;
+            auto next = node->next.load(std::memory_order_acquire);
+            if (!next) {
+                auto expect = node;
+                if (mTail.compare_exchange_strong(expect, nullptr, std::memory_order_release)) {
+                    release_node(node);
+                    return;
+                }
+                // A successor has swapped itself in but not linked yet
+                next = wait_for_successor(node);
+            }
+            next->locked.store(false, std::memory_order_release);
+            release_node(node);
+        }
+
+    private:
+        std::atomic<Node*> mTail = { nullptr };
+        Node* mHolder = nullptr;
+        [[no_unique_address]] Stats mStats{};
+    };
+
+    using McsLock = BasicMcsLock<>;
+}
@@ -0,0 +1,233 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include "SpinWait.h"
+#include "CacheLine.h"
+#include "EventCount.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Bounded multi-producer multi-consumer queue after Dmitry Vyukov's design. Every cell carries a sequence
+    // number telling whether it is ready for the producer or the consumer of a given position, so producers
+    // and consumers only contend on their own cache-line-padded position counter.
+    // The try_ operations never block. push() and pop() spin with SpinWait and then sleep on an EventCount,
+    // so the non-blocking paths only pay for a fence and a load when nobody sleeps.
+    // A claimed cell must be filled or emptied, or every later producer or consumer stalls at its position.
+    // Elements therefore move without throwing, and anything that may throw happens before a cell is claimed
+    // or after it has been released.
+    template<class T>
+    class MpmcQueue: public AddressSensitive {
+        static_assert(std::is_nothrow_move_constructible_v<T>, "elements are moved in and out of claimed cells");
+    public:
+        // The capacity is rounded up to a power of two
+        explicit MpmcQueue(std::size_t capacity) :
+                m_mask(round_up(capacity) - 1), m_cells(std::make_unique<Cell[]>(m_mask + 1)) {
+            for (std::size_t i = 0; i <= m_mask; ++i) m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        ~MpmcQueue() noexcept { while (try_consume([](T&&) noexcept {})) {} }
+
+        [[nodiscard]] std::size_t capacity() const noexcept { return m_mask + 1; }
+
+        // Only a snapshot, the queue may change before the caller looks at it
+        [[nodiscard]] std::size_t size_approx() const noexcept {
+            const auto tail = m_tail.load(std::memory_order_relaxed);
+            const auto head = m_head.load(std::memory_order_relaxed);
+            return tail > head ? tail - head : 0;
+        }
+
+        bool try_push(const T& value) { return try_emplace(value); }
+
+        bool try_push(T&& value) { return try_emplace(std::move(value)); }
+
+        // Arguments are left untouched if the queue is full. If constructing T from them may throw, T is built
+        // before claiming a cell and moved in afterwards, rvalue arguments are consumed even when it is full.
+        template<class ...Ts>
+        bool try_emplace(Ts&& ... args) {
+            if constexpr (std::is_nothrow_constructible_v<T, Ts&&...>) return try_emplace_nothrow(std::forward<Ts>(args)...);
+            else return try_emplace_nothrow(T(std::forward<Ts>(args)...));
+        }
+
+        bool try_pop(T& out) { return try_consume([&out](T&& value) { out = std::move(value); }); }
+
+        // Claims up to n consecutive cells with a single update of the tail and moves elements from first
+        // into them. Returns the number of elements pushed.
+        template<class It>
+        std::size_t push_n(It first, std::size_t n) {
+            static_assert(std::is_nothrow_constructible_v<T, decltype(std::move(*first))>,
+                          "push_n constructs in claimed cells, the elements must convert to T without throwing");
+            std::size_t pos, count;
+            if (!(count = claim(m_tail, pos, n, 0))) return 0;
+            for (std::size_t i = 0; i < count; ++i, ++first) {
+                auto& cell = m_cells[(pos + i) & m_mask];
+                new(cell.storage) T(std::move(*first));
+                cell.sequence.store(pos + i + 1, std::memory_order_release);
+            }
+            m_not_empty.notify(static_cast<uint32_t>(count));
+            return count;
+        }
+
+        // Claims up to n consecutive elements with a single update of the head and moves them to out.
+        // Returns the number of elements popped. Each element leaves its cell before it is assigned to out, if
+        // an assignment throws the rest of the claimed elements are dropped so that their cells are released.
+        template<class It>
+        std::size_t pop_n(It out, std::size_t n) {
+            std::size_t pos, count;
+            if (!(count = claim(m_head, pos, n, 1))) return 0;
+            std::size_t i = 0;
+            try {
+                for (; i < count; ++i, ++out) *out = take(pos + i);
+            }
+            catch (...) {
+                while (++i < count) take(pos + i);
+                m_not_full.notify(static_cast<uint32_t>(count));
+                throw;
+            }
+            m_not_full.notify(static_cast<uint32_t>(count));
+            return count;
+        }
+
+        void push(T value) {
+            block(m_not_full, [&]() { return try_emplace(std::move(value)); });
+        }
+
+        T pop() {
+            std::optional<T> result{};
+            block(m_not_empty, [&]() {
+                return try_consume([&result](T&& value) { result.emplace(std::move(value)); });
+            });
+            return std::move(*result);
+        }
+
+    private:
+        struct Cell {
+            std::atomic<std::size_t> sequence;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        const std::size_t m_mask;
+        const std::unique_ptr<Cell[]> m_cells;
+        alignas(CacheLineSize) std::atomic<std::size_t> m_tail{ 0 };
+        alignas(CacheLineSize) std::atomic<std::size_t> m_head{ 0 };
+        alignas(CacheLineSize) EventCount m_not_full{};
+        alignas(CacheLineSize) EventCount m_not_empty{};
+
+        static std::size_t round_up(std::size_t capacity) noexcept {
+            std::size_t result = 2;
+            while (result < capacity) result <<= 1;
+            return result;
+        }
+
+        template<class ...Ts>
+        bool try_emplace_nothrow(Ts&& ... args) noexcept {
+            auto pos = m_tail.load(std::memory_order_relaxed);
+            for (;;) {
+                auto& cell = m_cells[pos & m_mask];
+                const auto diff = static_cast<intptr_t>(cell.sequence.load(std::memory_order_acquire) - pos);
+                if (diff == 0) {
+                    if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                }
+                else if (diff < 0) return false;
+                else pos = m_tail.load(std::memory_order_relaxed);
+            }
+            auto& cell = m_cells[pos & m_mask];
+            new(cell.storage) T(std::forward<Ts>(args)...);
+            cell.sequence.store(pos + 1, std::memory_order_release);
+            m_not_empty.notify_one();
+            return true;
+        }
+
+        // Moves the element out of the claimed cell at pos and hands the cell back to the producers
+        T take(std::size_t pos) noexcept {
+            auto& cell = m_cells[pos & m_mask];
+            auto& value = *std::launder(reinterpret_cast<T*>(cell.storage));
+            T result(std::move(value));
+            value.~T();
+            cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+            return result;
+        }
+
+        // fn receives the element only after its cell is released, so it may throw
+        template<class Fn>
+        bool try_consume(Fn&& fn) {
+            auto pos = m_head.load(std::memory_order_relaxed);
+            for (;;) {
+                auto& cell = m_cells[pos & m_mask];
+                const auto diff = static_cast<intptr_t>(cell.sequence.load(std::memory_order_acquire) - (pos + 1));
+                if (diff == 0) {
+                    if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                }
+                else if (diff < 0) return false;
+                else pos = m_head.load(std::memory_order_relaxed);
+            }
+            auto value = take(pos);
+            m_not_full.notify_one();
+            fn(std::move(value));
+            return true;
+        }
+
+        // Claims the longest run of up to n ready cells starting at the current position. A cell at position p
+        // is ready once its sequence reads p + offset.
+        std::size_t claim(std::atomic<std::size_t>& counter, std::size_t& pos, std::size_t n, std::size_t offset) {
+            pos = counter.load(std::memory_order_relaxed);
+            for (;;) {
+                std::size_t count = 0;
+                while (count < n && count <= m_mask &&
+                       m_cells[(pos + count) & m_mask].sequence.load(std::memory_order_acquire) == pos + count + offset)
+                    ++count;
+                if (count) {
+                    if (counter.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) return count;
+                    continue;
+                }
+                const auto sequence = m_cells[pos & m_mask].sequence.load(std::memory_order_acquire);
+                if (static_cast<intptr_t>(sequence - (pos + offset)) < 0) return 0;
+                pos = counter.load(std::memory_order_relaxed);
+            }
+        }
+
+        template<class Fn>
+        static void block(EventCount& event, Fn&& attempt) {
+            SpinWait spinner{};
+            while (!spinner.will_yield()) {
+                if (attempt()) return;
+                spinner.once();
+            }
+            for (;;) {
+                const auto key = event.prepare_wait();
+                if (attempt()) {
+                    event.cancel_wait();
+                    return;
+                }
+                event.commit_wait(key);
+            }
+        }
+    };
+}
@@ -0,0 +1,179 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <new>
+#include <cstddef>
+#include <utility>
+#include "TSS.h"
+#include "MpmcQueue.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Fixed size object cache. Every thread allocates from and frees to its own free list without any
+    // synchronization. A list that grows past two batches hands its coldest batch to a lock-free depot,
+    // an empty one takes a batch from there before going to the heap, so objects freed on one thread are
+    // recycled by another in batches instead of one by one. Batches that do not fit into the depot go back
+    // to the heap. A thread exiting returns its list the same way through its TSS cleanup.
+    template<class T, std::size_t BatchSize = 32>
+    class ObjectPool: public AddressSensitive {
+        static_assert(BatchSize > 0);
+    public:
+        explicit ObjectPool(std::size_t depot_batches = 256) : m_depot(depot_batches) {}
+
+        template<class ...Ts>
+        T* create(Ts&& ... args) {
+            const auto p = allocate();
+            try {
+                return new(p) T(std::forward<Ts>(args)...);
+            }
+            catch (...) {
+                deallocate(p);
+                throw;
+            }
+        }
+
+        // May be called from any thread, not only the one that created the object
+        void destroy(T* p) noexcept {
+            if (!p) return;
+            p->~T();
+            deallocate(p);
+        }
+
+        // Raw storage for one T
+        [[nodiscard]] void* allocate() {
+            auto& cache = local();
+            if (!cache.head) refill(cache);
+            const auto slot = cache.head;
+            cache.head = slot->next;
+            --cache.count;
+            return slot->storage;
+        }
+
+        void deallocate(void* p) noexcept {
+            const auto slot = reinterpret_cast<Slot*>(p);
+            const auto cache = try_local();
+            // A thread that never allocated from the pool may fail to get a list, the heap takes the slot then
+            if (!cache) {
+                delete slot;
+                return;
+            }
+            slot->next = cache->head;
+            cache->head = slot;
+            if (++cache->count >= 2 * BatchSize) spill(*cache);
+        }
+
+    private:
+        union Slot {
+            Slot* next;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        struct Cache {
+            Slot* head = nullptr;
+            std::size_t count = 0;
+        };
+
+        // Holds chains of exactly BatchSize slots and frees whatever is left in it on destruction
+        struct Depot: MpmcQueue<Slot*> {
+            using MpmcQueue<Slot*>::MpmcQueue;
+
+            ~Depot() noexcept {
+                Slot* batch;
+                while (this->try_pop(batch)) free_chain(batch);
+            }
+        };
+
+        Depot m_depot;
+        // Declared last, deleting the key drains the list of every thread into the depot first
+        Pointer<Cache, void> m_local{ &drain, this };
+
+        Cache& local() {
+            if (const auto cache = try_local(); cache) return *cache;
+            throw std::bad_alloc();
+        }
+
+        // Null if the calling thread has no list yet and none can be allocated
+        Cache* try_local() noexcept {
+            if (const auto cache = m_local.get(); cache) return cache;
+            const auto cache = new(std::nothrow) Cache();
+            if (cache) m_local.reset(cache);
+            return cache;
+        }
+
+        void refill(Cache& cache) {
+            Slot* batch;
+            if (!m_depot.try_pop(batch)) {
+                batch = nullptr;
+                try {
+                    for (std::size_t i = 0; i < BatchSize; ++i) {
+                        const auto slot = new Slot;
+                        slot->next = batch;
+                        batch = slot;
+                    }
+                }
+                catch (...) {
+                    // Keep whatever we got, fail only if there is nothing at all
+                    if (!batch) throw;
+                    for (auto it = batch; it; it = it->next) ++cache.count;
+                    cache.head = batch;
+                    return;
+                }
+            }
+            cache.head = batch;
+            cache.count = BatchSize;
+        }
+
+        // Splits the older half off the list, the recently freed objects are still warm in our cache
+        void spill(Cache& cache) noexcept {
+            auto last = cache.head;
+            for (std::size_t i = 1; i < cache.count - BatchSize; ++i) last = last->next;
+            const auto batch = last->next;
+            last->next = nullptr;
+            cache.count -= BatchSize;
+            release(batch);
+        }
+
+        void release(Slot* batch) noexcept { if (!m_depot.try_push(batch)) free_chain(batch); }
+
+        static void free_chain(Slot* chain) noexcept {
+            while (chain) delete std::exchange(chain, chain->next);
+        }
+
+        static void drain(void* p, void* user) noexcept {
+            const auto cache = static_cast<Cache*>(p);
+            if (!cache) return;
+            const auto self = static_cast<ObjectPool*>(user);
+            while (cache->count >= BatchSize) {
+                if (cache->count == BatchSize) {
+                    self->release(cache->head);
+                    cache->head = nullptr;
+                    cache->count = 0;
+                }
+                else self->spill(*cache);
+            }
+            free_chain(cache->head);
+            delete cache;
+        }
+    };
+}
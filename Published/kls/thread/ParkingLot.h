@@ -0,0 +1,101 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <type_traits>
+
+// Global table of wait queues keyed by address, after WebKit's WTF::ParkingLot. Any byte of memory can
+// serve as the rendezvous point of a blocking primitive, so the primitive itself needs no kernel object
+// and can be as small as the state it really keeps. Threads park in FIFO order.
+namespace kls::thread::parking_lot {
+    enum class ParkResult { Unparked, Invalid, TimedOut };
+
+    struct UnparkResult {
+        // Whether a thread was dequeued, and whether more threads remain parked on the address
+        bool unparked, have_more;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    namespace detail {
+        template<class Fn>
+        auto thunk() noexcept { return [](void* fn) { return (*static_cast<Fn*>(fn))(); }; }
+
+        template<class T>
+        void* erase(T& value) noexcept { return const_cast<void*>(static_cast<const void*>(std::addressof(value))); }
+
+        ParkResult park(
+                const void* address, bool (* validate)(void*), void* validate_ctx,
+                void (* before_sleep)(void*), void* before_sleep_ctx, const Clock::time_point* deadline
+        ) noexcept;
+
+        UnparkResult unpark_one(const void* address, void (* callback)(void*, UnparkResult), void* ctx) noexcept;
+    }
+
+    // Parks the calling thread on address if validate() returns true. validate() runs with the queue of the
+    // address locked, so an unpark on the same address cannot slip in between the check and the enqueue.
+    // before_sleep() runs after the queue has been unlocked, right before the thread goes to sleep.
+    // Both callbacks must not park or unpark themselves.
+    template<class Validate, class BeforeSleep>
+    ParkResult park(const void* address, Validate&& validate, BeforeSleep&& before_sleep) noexcept {
+        return detail::park(
+                address, detail::thunk<std::remove_reference_t<Validate>>(), detail::erase(validate),
+                detail::thunk<std::remove_reference_t<BeforeSleep>>(), detail::erase(before_sleep), nullptr
+        );
+    }
+
+    template<class Validate, class BeforeSleep>
+    ParkResult park(
+            const void* address, Validate&& validate, BeforeSleep&& before_sleep, Clock::time_point deadline
+    ) noexcept {
+        return detail::park(
+                address, detail::thunk<std::remove_reference_t<Validate>>(), detail::erase(validate),
+                detail::thunk<std::remove_reference_t<BeforeSleep>>(), detail::erase(before_sleep), &deadline
+        );
+    }
+
+    template<class Validate>
+    ParkResult park(const void* address, Validate&& validate) noexcept {
+        return park(address, std::forward<Validate>(validate), []() noexcept {});
+    }
+
+    // Wakes the thread that has been parked on address the longest. callback() runs with the queue still
+    // locked, before the thread wakes up, and is told whether anyone is left behind so that the caller can
+    // update its own state before the next thread is able to park.
+    template<class Callback>
+    UnparkResult unpark_one(const void* address, Callback&& callback) noexcept {
+        return detail::unpark_one(address, [](void* fn, UnparkResult result) {
+            (*static_cast<std::remove_reference_t<Callback>*>(fn))(result);
+        }, detail::erase(callback));
+    }
+
+    inline UnparkResult unpark_one(const void* address) noexcept {
+        return detail::unpark_one(address, nullptr, nullptr);
+    }
+
+    // Returns the number of threads woken
+    unsigned int unpark_all(const void* address) noexcept;
+}
@@ -0,0 +1,122 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "ParkingLot.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // One byte mutex that parks contended waiters in the ParkingLot, small enough to embed one per hash
+    // bucket or per object. Locked marks the owner, HasParked tells unlock() that it has to go through the
+    // parking lot. A released lock may be barged by a running thread before the woken one gets to it.
+    class ParkingMutex: public AddressSensitive {
+    public:
+        void lock() noexcept {
+            auto expect = Unlocked;
+            if (!mState.compare_exchange_weak(expect, Locked, std::memory_order_acquire, std::memory_order_relaxed))
+                lock_slow();
+        }
+
+        bool try_lock() noexcept {
+            auto state = mState.load(std::memory_order_relaxed);
+            while (!(state & Locked)) {
+                if (mState.compare_exchange_weak(state, state | Locked, std::memory_order_acquire)) return true;
+            }
+            return false;
+        }
+
+        void unlock() noexcept {
+            auto expect = Locked;
+            if (!mState.compare_exchange_strong(expect, Unlocked, std::memory_order_release, std::memory_order_relaxed))
+                unlock_slow();
+        }
+
+    private:
+        static constexpr uint8_t Unlocked = 0, Locked = 1, HasParked = 2;
+
+        std::atomic<uint8_t> mState{ Unlocked };
+
+        void lock_slow() noexcept;
+
+        void unlock_slow() noexcept;
+    };
+
+    static_assert(sizeof(ParkingMutex) == 1);
+
+    // Condition variable on the ParkingLot, one byte as well. Works with any lock that has lock()/unlock().
+    class ParkingCondition: public AddressSensitive {
+    public:
+        template<class Lock>
+        void wait(Lock& lock) noexcept {
+            parking_lot::park(this, [this]() noexcept { return validate(); }, [&lock]() noexcept { lock.unlock(); });
+            lock.lock();
+        }
+
+        template<class Lock, class Predicate>
+        void wait(Lock& lock, Predicate predicate) { while (!predicate()) wait(lock); }
+
+        // Returns false if the deadline has passed
+        template<class Lock, class Duration>
+        bool wait_until(Lock& lock, const std::chrono::time_point<parking_lot::Clock, Duration>& absTime) noexcept {
+            const auto result = parking_lot::park(
+                    this, [this]() noexcept { return validate(); }, [&lock]() noexcept { lock.unlock(); }, absTime
+            );
+            lock.lock();
+            return result != parking_lot::ParkResult::TimedOut;
+        }
+
+        template<class Lock, class Rep, class Period>
+        bool wait_for(Lock& lock, const std::chrono::duration<Rep, Period>& relTime) noexcept {
+            const auto deadline = parking_lot::Clock::now() + relTime;
+            return wait_until(lock, std::chrono::time_point_cast<parking_lot::Clock::duration>(deadline));
+        }
+
+        // No parking lot access at all while nobody waits
+        void notify_one() noexcept {
+            if (!mHasWaiters.load(std::memory_order_relaxed)) return;
+            parking_lot::unpark_one(this, [this](parking_lot::UnparkResult result) noexcept {
+                if (!result.have_more) mHasWaiters.store(false, std::memory_order_relaxed);
+            });
+        }
+
+        void notify_all() noexcept {
+            if (!mHasWaiters.load(std::memory_order_relaxed)) return;
+            mHasWaiters.store(false, std::memory_order_relaxed);
+            parking_lot::unpark_all(this);
+        }
+
+    private:
+        std::atomic_bool mHasWaiters{ false };
+
+        // Runs under the queue lock, before the caller's lock is released
+        bool validate() noexcept {
+            mHasWaiters.store(true, std::memory_order_relaxed);
+            return true;
+        }
+    };
+
+    static_assert(sizeof(ParkingCondition) == 1);
+}
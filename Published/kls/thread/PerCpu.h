@@ -0,0 +1,249 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include "SpinLock.h"
+#include "Topology.h"
+#include "CacheLine.h"
+#include "kls/Object.h"
+
+#if defined(__linux__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define KLS_THREAD_RSEQ
+#if defined(__x86_64__) && defined(__GNUC__)
+#define KLS_THREAD_RSEQ_X86_64
+#endif
+#endif
+
+namespace kls::thread {
+    namespace percpu {
+        // Number of slots in every per-CPU container: one past the highest CPU id the kernel may ever
+        // report, so CPUs brought online later and CPUs outside our affinity mask still have a slot
+        unsigned int count() noexcept;
+
+#ifdef KLS_THREAD_RSEQ
+        namespace detail {
+            // glibc registers an rseq area for every thread it creates and publishes where it lives
+            inline volatile rseq* area() noexcept {
+                return reinterpret_cast<volatile rseq*>(static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+            }
+
+            inline int registered_cpu() noexcept { return __rseq_size ? static_cast<int>(area()->cpu_id) : -1; }
+        }
+
+        // Whether the calling thread has a registered rseq area, i.e. current() is a plain load
+        inline bool has_rseq() noexcept { return detail::registered_cpu() >= 0; }
+
+        // The CPU the caller is running on right now, which may change at any moment
+        inline unsigned int current() noexcept {
+            if (const auto cpu = detail::registered_cpu(); cpu >= 0) return static_cast<unsigned int>(cpu);
+            return Topology::current_cpu();
+        }
+#else
+        inline bool has_rseq() noexcept { return false; }
+
+        inline unsigned int current() noexcept { return Topology::current_cpu(); }
+#endif
+
+#ifdef KLS_THREAD_RSEQ_X86_64
+        namespace detail {
+            // Restartable sequence adding v to the Stride-spaced cell of the current CPU. The CPU id is loaded
+            // inside the critical section and the add is its commit instruction, so preemption, migration
+            // or a signal before the add sends us to the abort handler and nothing was written. Returns
+            // false in that case. The abort handler is preceded by the signature glibc registered.
+            template<std::size_t Stride>
+            inline bool try_add(void* base, int64_t v) noexcept {
+                const auto rs = area();
+                asm goto(
+                        ".pushsection __rseq_cs, \"aw\"\n\t"
+                        ".balign 32\n\t"
+                        "3:\n\t"
+                        ".long 0, 0\n\t"
+                        ".quad 1f, 2f - 1f, 4f\n\t"
+                        ".popsection\n\t"
+                        "leaq 3b(%%rip), %%rax\n\t"
+                        "movq %%rax, %[rseq_cs]\n\t"
+                        "1:\n\t"
+                        "movl %[cpu_id], %%eax\n\t"
+                        "imulq %[stride], %%rax, %%rax\n\t"
+                        "addq %[v], (%[base], %%rax)\n\t"
+                        "2:\n\t"
+                        ".pushsection __rseq_failure, \"ax\"\n\t"
+                        ".byte 0x0f, 0xb9, 0x3d\n\t"
+                        ".long 0x53053053\n\t"
+                        "4:\n\t"
+                        "jmp %l[abort]\n\t"
+                        ".popsection\n\t"
+                        :
+                        : [rseq_cs] "m"(rs->rseq_cs), [cpu_id] "m"(rs->cpu_id),
+                          [stride] "i"(Stride), [v] "r"(v), [base] "r"(base)
+                        : "memory", "cc", "rax"
+                        : abort
+                );
+                return true;
+            abort:
+                return false;
+            }
+        }
+#endif
+    }
+
+    // One cache-line-aligned T per CPU. local() picks the slot of the CPU the caller runs on, but the caller
+    // may be migrated at any point afterwards and another thread may land on the same CPU, so slots must
+    // be accessed with atomics or under a lock. This is what keeps memory proportional to the number of
+    // CPUs rather than threads, and makes visiting all slots cheap.
+    template<class T>
+    class PerCpu: public AddressSensitive {
+        struct alignas(CacheLineSize) Slot {
+            T value{};
+        };
+    public:
+        // Distance in bytes between the slots of two consecutive CPUs
+        static constexpr std::size_t Stride = sizeof(Slot);
+
+        PerCpu() : m_size(percpu::count()), m_slots(std::make_unique<Slot[]>(m_size)) {}
+
+        [[nodiscard]] unsigned int size() const noexcept { return m_size; }
+
+        T& local() noexcept { return m_slots[index()].value; }
+
+        T& operator[](unsigned int cpu) noexcept { return m_slots[cpu].value; }
+
+        const T& operator[](unsigned int cpu) const noexcept { return m_slots[cpu].value; }
+
+        template<class Fn>
+        void for_each(Fn fn) { for (unsigned int i = 0; i < m_size; ++i) fn(m_slots[i].value); }
+
+        template<class Fn>
+        void for_each(Fn fn) const { for (unsigned int i = 0; i < m_size; ++i) fn(static_cast<const T&>(m_slots[i].value)); }
+
+        // Slot index of the calling CPU, guarded against ids past count() on platforms that cannot tell
+        [[nodiscard]] unsigned int index() const noexcept {
+            const auto cpu = percpu::current();
+            return cpu < m_size ? cpu : cpu % m_size;
+        }
+
+    private:
+        const unsigned int m_size;
+        const std::unique_ptr<Slot[]> m_slots;
+    };
+
+    // Statistics counter sharded by CPU. On x86-64 Linux with rseq an add is a plain, non-locked add into
+    // the current CPU's cell, committed by a restartable sequence. Elsewhere it is a relaxed fetch_add
+    // on the cell of the CPU reported by sched_getcpu(), which is rarely contended.
+    // sum() is only a snapshot while adds are in flight.
+    class PerCpuCounter: public AddressSensitive {
+    public:
+        void add(int64_t v = 1) noexcept {
+#ifdef KLS_THREAD_RSEQ_X86_64
+            // rseq registration is all or nothing for the threads glibc creates, threads without it can
+            // only come from raw clone() calls and fall back to the locked add
+            if (percpu::has_rseq()) {
+                while (!percpu::detail::try_add<PerCpu<Cell>::Stride>(&m_cells[0], v)) {}
+                return;
+            }
+#endif
+            m_cells.local().value.fetch_add(v, std::memory_order_relaxed);
+        }
+
+        void sub(int64_t v = 1) noexcept { add(-v); }
+
+        [[nodiscard]] int64_t sum() const noexcept {
+            int64_t result = 0;
+            m_cells.for_each([&result](const Cell& cell) { result += cell.value.load(std::memory_order_relaxed); });
+            return result;
+        }
+
+        // Not atomic with respect to concurrent adds, which may survive the reset
+        void reset() noexcept {
+            m_cells.for_each([](Cell& cell) { cell.value.store(0, std::memory_order_relaxed); });
+        }
+
+    private:
+        struct Cell {
+            std::atomic<int64_t> value{ 0 };
+        };
+
+        PerCpu<Cell> m_cells{};
+    };
+
+    // Intrusive LIFO free lists, one per CPU and each behind its own SpinLock. Nodes need a `Node* next`
+    // member. pop() tries the list of the current CPU before visiting the others, so nodes freed on a CPU
+    // tend to be reused there while they are still in its cache, and the locks only see contention when
+    // threads share a CPU or a list runs dry. The lists do not own their nodes, see drain().
+    template<class Node>
+    class PerCpuFreeList: public AddressSensitive {
+    public:
+        void push(Node* node) noexcept {
+            auto& list = m_lists.local();
+            std::lock_guard lock(list.lock);
+            node->next = list.head.load(std::memory_order_relaxed);
+            list.head.store(node, std::memory_order_relaxed);
+        }
+
+        // Null if every list is empty
+        Node* pop() noexcept {
+            const auto home = m_lists.index();
+            for (unsigned int i = 0; i < m_lists.size(); ++i) {
+                auto& list = m_lists[(home + i) % m_lists.size()];
+                // Peek first, so that walking past empty lists does not take their locks
+                if (!list.head.load(std::memory_order_relaxed)) continue;
+                std::lock_guard lock(list.lock);
+                if (const auto node = list.head.load(std::memory_order_relaxed); node) {
+                    list.head.store(node->next, std::memory_order_relaxed);
+                    return node;
+                }
+            }
+            return nullptr;
+        }
+
+        // Empties every list, handing each node to fn, e.g. to free them before the list goes away
+        template<class Fn>
+        void drain(Fn fn) {
+            m_lists.for_each([&fn](List& list) {
+                list.lock.lock();
+                auto head = list.head.exchange(nullptr, std::memory_order_relaxed);
+                list.lock.unlock();
+                while (head) {
+                    const auto node = head;
+                    head = head->next;
+                    fn(node);
+                }
+            });
+        }
+
+    private:
+        struct List {
+            SpinLock lock{};
+            // Only written under the lock, atomic so that pop() may peek without it
+            std::atomic<Node*> head{ nullptr };
+        };
+
+        PerCpu<List> m_lists{};
+    };
+}
@@ -0,0 +1,107 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cassert>
+#include <type_traits>
+#include "SpinLock.h"
+#include "EpochDomain.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Read-copy-update cell holding the current version of an object that is replaced as a whole. Readers
+    // take a ReadGuard, which enters the epoch domain and loads the pointer: no shared writes and no
+    // reference counts. Writers publish a new version with store() or update() and retire the old one into
+    // the domain, which frees it once every thread that could still be reading it has left its guard.
+    // Writers are serialized among themselves.
+    template<class T>
+    class RcuCell: public AddressSensitive {
+    public:
+        class ReadGuard {
+        public:
+            [[nodiscard]] const T* get() const noexcept { return m_value; }
+
+            const T& operator*() const noexcept { return *m_value; }
+
+            const T* operator->() const noexcept { return m_value; }
+
+            explicit operator bool() const noexcept { return m_value; }
+
+        private:
+            friend class RcuCell;
+
+            ReadGuard(EpochDomain::Guard guard, const T* value) noexcept: m_guard(std::move(guard)), m_value(value) {}
+
+            EpochDomain::Guard m_guard;
+            const T* m_value;
+        };
+
+        explicit RcuCell(std::unique_ptr<T> initial = nullptr, EpochDomain& domain = EpochDomain::global()) noexcept:
+                m_current(initial.release()), m_domain(domain) {}
+
+        // Nobody may read any more, so the last version goes right away
+        ~RcuCell() noexcept { delete m_current.load(std::memory_order_relaxed); }
+
+        // The version seen stays valid until the guard goes away, even if it is replaced meanwhile
+        [[nodiscard]] ReadGuard read() const noexcept {
+            auto guard = m_domain.enter();
+            return { std::move(guard), m_current.load(std::memory_order_acquire) };
+        }
+
+        void store(std::unique_ptr<T> value) {
+            std::lock_guard lock(m_writer);
+            publish(value.release());
+        }
+
+        // Copies the current version, lets fn modify the copy and publishes it. An empty cell starts from a
+        // default constructed T, a T without a default constructor needs a value stored first.
+        template<class Fn>
+        void update(Fn&& fn) {
+            std::lock_guard lock(m_writer);
+            const auto current = m_current.load(std::memory_order_relaxed);
+            std::unique_ptr<T> next;
+            if constexpr (std::is_default_constructible_v<T>) {
+                next = current ? std::make_unique<T>(*current) : std::make_unique<T>();
+            }
+            else {
+                assert(current && "update() on an empty RcuCell needs a default constructible T");
+                next = std::make_unique<T>(*current);
+            }
+            fn(*next);
+            publish(next.release());
+        }
+
+    private:
+        std::atomic<T*> m_current;
+        EpochDomain& m_domain;
+        SpinLock m_writer;
+
+        void publish(T* value) {
+            if (const auto old = m_current.exchange(value, std::memory_order_acq_rel); old) m_domain.retire(old);
+        }
+    };
+}
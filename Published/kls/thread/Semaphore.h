@@ -24,21 +24,126 @@
 
 #include <chrono>
 
-#if __has_include(<mach/semaphore.h>)
+#if __has_include(<linux/futex.h>)
+#include <atomic>
+#include <limits>
+#include "Futex.h"
+#include "SpinWait.h"
+#include "LockStats.h"
+
+namespace kls::thread {
+    // Lightweight semaphore, the count lives in user space and the kernel is only entered when a waiter
+    // has to be parked or a parked waiter has to be woken.
+    // Semaphore units are not held by anyone in particular, so Stats only accounts for acquisitions.
+    template<class Stats = stats::Disabled>
+    class BasicSemaphore {
+    public:
+        BasicSemaphore() noexcept = default;
+
+        void wait() noexcept {
+            if (try_acquire()) {
+                mStats.acquired_shared();
+                return;
+            }
+            const auto since = mStats.contended();
+            SpinWait spinner{};
+            if (!spin_wait(spinner)) {
+                m_waiters.fetch_add(1, std::memory_order_seq_cst);
+                while (!try_acquire()) futex::wait(m_count, 0);
+                m_waiters.fetch_sub(1, std::memory_order_relaxed);
+            }
+            mStats.acquired_shared(since, spinner.count());
+        }
+
+        bool try_wait() noexcept {
+            if (!try_acquire()) return false;
+            mStats.acquired_shared();
+            return true;
+        }
+
+        template<class Rep, class Period>
+        bool wait_for(const std::chrono::duration<Rep, Period>& relTime) noexcept {
+            return wait_until(std::chrono::steady_clock::now() + relTime);
+        }
+
+        template<class Clock, class Duration>
+        bool wait_until(const std::chrono::time_point<Clock, Duration>& absTime) noexcept {
+            if (try_acquire()) {
+                mStats.acquired_shared();
+                return true;
+            }
+            const auto since = mStats.contended();
+            SpinWait spinner{};
+            auto success = true;
+            if (!spin_wait(spinner)) {
+                m_waiters.fetch_add(1, std::memory_order_seq_cst);
+                while (!try_acquire()) {
+                    if (!futex::wait_until(m_count, 0, absTime)) {
+                        success = try_acquire();
+                        break;
+                    }
+                }
+                m_waiters.fetch_sub(1, std::memory_order_relaxed);
+            }
+            if (success) mStats.acquired_shared(since, spinner.count());
+            return success;
+        }
+
+        void signal(unsigned int count = 1) noexcept {
+            m_count.fetch_add(count, std::memory_order_seq_cst);
+            // Wake at most as many sleepers as there are new units, all in one syscall
+            if (const auto waiters = m_waiters.load(std::memory_order_seq_cst); waiters)
+                futex::wake(m_count, waiters < count ? waiters : count);
+        }
+
+    private:
+        std::atomic<uint32_t> m_count{ 0 };
+        std::atomic<uint32_t> m_waiters{ 0 };
+        [[no_unique_address]] Stats mStats{};
+
+        bool try_acquire() noexcept {
+            auto count = m_count.load(std::memory_order_relaxed);
+            while (count) {
+                if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire)) return true;
+            }
+            return false;
+        }
+
+        bool spin_wait(SpinWait& spinner) noexcept {
+            for (auto i = 0u; i < SpinWait::spin_count_before_wait(); ++i) {
+                spinner.once(std::numeric_limits<unsigned int>::max());
+                if (try_acquire()) return true;
+            }
+            return false;
+        }
+    };
+}
+
+#elif __has_include(<mach/semaphore.h>)
 #include <mach/semaphore.h>
 #include <mach/mach_init.h>
 #include <mach/task.h>
+#include "LockStats.h"
 
 namespace kls::thread {
-    class Semaphore {
+    template<class Stats = stats::Disabled>
+    class BasicSemaphore {
     public:
-        explicit Semaphore() noexcept
+        explicit BasicSemaphore() noexcept
             :handle(New()) { }
 
-        ~Semaphore() { Release(handle); }
+        ~BasicSemaphore() { Release(handle); }
 
         void wait() noexcept {
+            if constexpr (Stats::IsEnabled) {
+                if (timed_wait(0)) {
+                    mStats.acquired_shared();
+                    return;
+                }
+            }
+            const auto since = mStats.contended();
             while (semaphore_wait(handle) != KERN_SUCCESS) {}
+            mStats.acquired_shared(since, 0);
         }
 
         template <class Rep, class Period>
@@ -51,7 +156,7 @@ namespace kls::thread {
             return wait_for(absTime - Clock::now());
         }
 
-        void signal() noexcept { aemaphore_signal(handle); }
+        void signal(unsigned int count = 1) noexcept { while (count--) semaphore_signal(handle); }
     private:
         static semaphore_t New() noexcept {
             semaphore_t ret;
@@ -73,22 +178,35 @@ namespace kls::thread {
         }
 
         Semaphore_t handle;
+        [[no_unique_address]] Stats mStats{};
     };
 }
 
 #elif __has_include(<Windows.h>)
 
 #include "kls/hal/System.h"
+#include "LockStats.h"
 
 namespace kls::thread {
-    class Semaphore {
+    template<class Stats = stats::Disabled>
+    class BasicSemaphore {
     public:
-        Semaphore() noexcept
+        BasicSemaphore() noexcept
             : handle(CreateSemaphore(nullptr, 0, MAXLONG, nullptr)) {}
 
-        ~Semaphore() noexcept { CloseHandle(handle); }
+        ~BasicSemaphore() noexcept { CloseHandle(handle); }
 
-        void wait() noexcept { WaitForSingleObject(handle, INFINITE); }
+        void wait() noexcept {
+            if constexpr (Stats::IsEnabled) {
+                if (timed_wait(0)) {
+                    mStats.acquired_shared();
+                    return;
+                }
+            }
+            const auto since = mStats.contended();
+            WaitForSingleObject(handle, INFINITE);
+            mStats.acquired_shared(since, 0);
+        }
 
         template <class Rep, class Period>
         bool wait_for(const std::chrono::duration<Rep, Period>& relTime) noexcept {
@@ -100,13 +218,14 @@ namespace kls::thread {
             return wait_for(absTime - Clock::now());
         }
 
-        void signal() noexcept {
+        void signal(unsigned int count = 1) noexcept {
             LONG last;
-            ReleaseSemaphore(handle, 1, &last);
+            ReleaseSemaphore(handle, static_cast<LONG>(count), &last);
         }
 
     private:
         HANDLE handle;
+        [[no_unique_address]] Stats mStats{};
 
         bool timed_wait(const long long ms) noexcept {
             return WaitForSingleObject(handle, static_cast<DWORD>(ms)) != WAIT_TIMEOUT;
@@ -117,15 +236,27 @@ namespace kls::thread {
 #elif __has_include(<semaphore.h>)
 
 #include <semaphore.h>
+#include "LockStats.h"
 
 namespace kls::thread {
-    class Semaphore {
+    template<class Stats = stats::Disabled>
+    class BasicSemaphore {
     public:
-        Semaphore() noexcept { sem_init(&mSem, 0, 0); }
+        BasicSemaphore() noexcept { sem_init(&mSem, 0, 0); }
 
-        ~Semaphore() noexcept { sem_destroy(&mSem); }
+        ~BasicSemaphore() noexcept { sem_destroy(&mSem); }
 
-        void wait() noexcept { sem_wait(&mSem); }
+        void wait() noexcept {
+            if constexpr (Stats::IsEnabled) {
+                if (sem_trywait(&mSem) == 0) {
+                    mStats.acquired_shared();
+                    return;
+                }
+            }
+            const auto since = mStats.contended();
+            sem_wait(&mSem);
+            mStats.acquired_shared(since, 0);
+        }
 
         template<class Rep, class Period>
         bool wait_for(const std::chrono::duration<Rep, Period>& relTime) noexcept {
@@ -138,10 +269,11 @@ namespace kls::thread {
             return (sem_timedwait(&mSem, &spec) == 0);
         }
 
-        void signal() noexcept { sem_post(&mSem); }
+        void signal(unsigned int count = 1) noexcept { while (count--) sem_post(&mSem); }
 
     private:
         sem_t mSem{};
+        [[no_unique_address]] Stats mStats{};
 
         template<class Clock, class Duration>
         timespec Timespec(const std::chrono::time_point<Clock, Duration>& tp) {
@@ -155,18 +287,25 @@ namespace kls::thread {
 
 #else
 
+#include "LockStats.h"
+
 namespace kls::thread {
-    class Semaphore {
+    template<class Stats = stats::Disabled>
+    class BasicSemaphore {
     public:
-        Semaphore() noexcept {}
+        BasicSemaphore() noexcept {}
 
-        ~Semaphore() noexcept {}
+        ~BasicSemaphore() noexcept {}
 
         void wait() noexcept {}
 
-        void signal() noexcept {}
+        void signal(unsigned int = 1) noexcept {}
     };
 }
 
 # error "No Adaquate Semaphore Supported to be adapted from"
-#endif
\ No newline at end of file
+#endif
+
+namespace kls::thread {
+    using Semaphore = BasicSemaphore<>;
+}
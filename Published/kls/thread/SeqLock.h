@@ -0,0 +1,106 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "SpinLock.h"
+#include "SpinWait.h"
+#include "CacheLine.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // For a SeqLock that is only ever written from one thread at a time anyway
+    struct SingleWriter {
+        void lock() noexcept {}
+
+        void unlock() noexcept {}
+    };
+
+    // Sequence lock around a small trivially copyable value. Readers never write shared memory: they copy
+    // the value between two reads of the sequence and retry if a writer got in between, spinning with
+    // SpinWait while the sequence is odd. Writers never wait for readers, only for each other on WriterLock.
+    // The value is kept as relaxed atomic words so that the racy copy of a torn read is well defined.
+    template<class T, class WriterLock = SpinLock>
+    class SeqLock: public AddressSensitive {
+        static_assert(std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>);
+    public:
+        explicit SeqLock(const T& initial = T{}) noexcept { write(initial); }
+
+        [[nodiscard]] T load() const noexcept {
+            Word buffer[Words];
+            SpinWait spinner{};
+            for (;;) {
+                const auto sequence = m_sequence.load(std::memory_order_acquire);
+                if (!(sequence & 1)) {
+                    for (std::size_t i = 0; i < Words; ++i) buffer[i] = m_words[i].load(std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (m_sequence.load(std::memory_order_relaxed) == sequence) break;
+                }
+                spinner.once();
+            }
+            T result;
+            std::memcpy(&result, buffer, sizeof(T));
+            return result;
+        }
+
+        void store(const T& value) noexcept {
+            std::lock_guard lock(m_writer);
+            write(value);
+        }
+
+        // Runs fn on a copy of the current value and publishes the result, writers are serialized
+        template<class Fn>
+        void update(Fn&& fn) {
+            std::lock_guard lock(m_writer);
+            Word buffer[Words];
+            for (std::size_t i = 0; i < Words; ++i) buffer[i] = m_words[i].load(std::memory_order_relaxed);
+            T value;
+            std::memcpy(&value, buffer, sizeof(T));
+            fn(value);
+            write(value);
+        }
+
+    private:
+        using Word = std::uintptr_t;
+        static constexpr std::size_t Words = (sizeof(T) + sizeof(Word) - 1) / sizeof(Word);
+
+        alignas(CacheLineSize) std::atomic<uint64_t> m_sequence{ 0 };
+        std::atomic<Word> m_words[Words]{};
+        alignas(CacheLineSize) [[no_unique_address]] WriterLock m_writer{};
+
+        void write(const T& value) noexcept {
+            Word buffer[Words]{};
+            std::memcpy(buffer, &value, sizeof(T));
+            const auto sequence = m_sequence.load(std::memory_order_relaxed);
+            m_sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (std::size_t i = 0; i < Words; ++i) m_words[i].store(buffer[i], std::memory_order_relaxed);
+            m_sequence.store(sequence + 2, std::memory_order_release);
+        }
+    };
+}
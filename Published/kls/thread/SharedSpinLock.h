@@ -0,0 +1,155 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include "SpinWait.h"
+#include "CacheLine.h"
+#include "LockStats.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Reader-writer spin lock with writer preference. Readers announce themselves in one of several
+    // cache-line-sized slots chosen per thread instead of a single shared counter, so the read path
+    // scales with the number of cores. A writer raises its flag, which turns new readers away, and then
+    // waits for every slot to drain.
+    template<class Stats = stats::Disabled>
+    class BasicSharedSpinLock: public AddressSensitive {
+    public:
+        static constexpr unsigned int ReaderSlots = 32;
+
+        void lock() noexcept {
+            const auto since = mStats.contended();
+            unsigned int spins = 0;
+            for (;;) {
+                auto expect = false;
+                if (mWriter.compare_exchange_strong(expect, true, std::memory_order_seq_cst)) break;
+                spins += wait_for_writer();
+            }
+            spins += wait_for_readers();
+            if (spins) mStats.acquired(since, spins); else mStats.acquired();
+        }
+
+        bool try_lock() noexcept {
+            auto expect = false;
+            if (!mWriter.compare_exchange_strong(expect, true, std::memory_order_seq_cst)) return false;
+            for (auto& slot: mSlots) {
+                if (slot.readers.load(std::memory_order_seq_cst)) {
+                    mWriter.store(false, std::memory_order_release);
+                    return false;
+                }
+            }
+            mStats.acquired();
+            return true;
+        }
+
+        void unlock() noexcept {
+            mStats.released();
+            mWriter.store(false, std::memory_order_release);
+        }
+
+        void lock_shared() noexcept {
+            auto& readers = mSlots[slot_index()].readers;
+            readers.fetch_add(1, std::memory_order_seq_cst);
+            if (!mWriter.load(std::memory_order_seq_cst)) {
+                mStats.acquired_shared();
+                return;
+            }
+            const auto since = mStats.contended();
+            unsigned int spins = 0;
+            for (;;) {
+                readers.fetch_sub(1, std::memory_order_release);
+                spins += wait_for_writer();
+                readers.fetch_add(1, std::memory_order_seq_cst);
+                if (!mWriter.load(std::memory_order_seq_cst)) break;
+            }
+            mStats.acquired_shared(since, spins);
+        }
+
+        bool try_lock_shared() noexcept {
+            auto& readers = mSlots[slot_index()].readers;
+            readers.fetch_add(1, std::memory_order_seq_cst);
+            if (!mWriter.load(std::memory_order_seq_cst)) {
+                mStats.acquired_shared();
+                return true;
+            }
+            readers.fetch_sub(1, std::memory_order_release);
+            return false;
+        }
+
+        void unlock_shared() noexcept { mSlots[slot_index()].readers.fetch_sub(1, std::memory_order_release); }
+
+        // Turns a shared lock held by the calling thread into an exclusive one. Fails without waiting if
+        // another writer is already pending, in which case the caller should drop its shared lock so that
+        // the writer can make progress.
+        bool try_upgrade() noexcept {
+            auto expect = false;
+            if (!mWriter.compare_exchange_strong(expect, true, std::memory_order_seq_cst)) return false;
+            const auto since = mStats.contended();
+            mSlots[slot_index()].readers.fetch_sub(1, std::memory_order_release);
+            mStats.acquired(since, wait_for_readers());
+            return true;
+        }
+
+        // Turns the exclusive lock held by the calling thread into a shared one without letting another
+        // writer in between
+        void downgrade() noexcept {
+            mStats.released();
+            mSlots[slot_index()].readers.fetch_add(1, std::memory_order_relaxed);
+            mWriter.store(false, std::memory_order_release);
+        }
+
+    private:
+        struct alignas(CacheLineSize) Slot {
+            std::atomic<uint32_t> readers = { 0 };
+        };
+
+        static unsigned int slot_index() noexcept {
+            static std::atomic<unsigned int> next{ 0 };
+            static thread_local const unsigned int index = next.fetch_add(1, std::memory_order_relaxed) % ReaderSlots;
+            return index;
+        }
+
+        unsigned int wait_for_writer() const noexcept {
+            SpinWait spinner{};
+            while (mWriter.load(std::memory_order_relaxed)) { spinner.once(); }
+            return spinner.count();
+        }
+
+        unsigned int wait_for_readers() const noexcept {
+            unsigned int spins = 0;
+            for (auto& slot: mSlots) {
+                SpinWait spinner{};
+                while (slot.readers.load(std::memory_order_seq_cst)) { spinner.once(); }
+                spins += spinner.count();
+            }
+            return spins;
+        }
+
+        Slot mSlots[ReaderSlots];
+        alignas(CacheLineSize) std::atomic_bool mWriter = { false };
+        [[no_unique_address]] Stats mStats{};
+    };
+
+    using SharedSpinLock = BasicSharedSpinLock<>;
+}
@@ -24,27 +24,54 @@
 
 #include <atomic>
 #include "SpinWait.h"
+#include "LockStats.h"
 #include "kls/Object.h"
 
 namespace kls::thread {
-    class SpinLock: public AddressSensitive {
+    template<class Stats = stats::Disabled>
+    class BasicSpinLock: public AddressSensitive {
     public:
         void lock() noexcept {
+            auto expect = false;
+            if (mLock.compare_exchange_strong(expect, true, std::memory_order_acquire)) {
+                mStats.acquired();
+                return;
+            }
+            const auto since = mStats.contended();
+            unsigned int spins = 0;
             for (;;) {
-                auto expect = false;
-                if (mLock.compare_exchange_strong(expect, true, std::memory_order_acquire)) return;
-                wait_for_lock();
+                spins += wait_for_lock();
+                expect = false;
+                if (mLock.compare_exchange_strong(expect, true, std::memory_order_acquire)) break;
             }
+            mStats.acquired(since, spins);
         }
 
-        void unlock() noexcept { mLock.store(false, std::memory_order_release); }
+        // Gives up without touching the lock line for writing if the lock is visibly taken
+        bool try_lock() noexcept {
+            auto expect = false;
+            if (mLock.load(std::memory_order_relaxed) ||
+                !mLock.compare_exchange_strong(expect, true, std::memory_order_acquire))
+                return false;
+            mStats.acquired();
+            return true;
+        }
+
+        void unlock() noexcept {
+            mStats.released();
+            mLock.store(false, std::memory_order_release);
+        }
 
     private:
-        void wait_for_lock() const noexcept {
+        unsigned int wait_for_lock() const noexcept {
             SpinWait spinner{};
             while (mLock.load(std::memory_order_relaxed)) { spinner.once(); }
+            return spinner.count();
         }
 
         std::atomic_bool mLock = { false };
+        [[no_unique_address]] Stats mStats{};
     };
+
+    using SpinLock = BasicSpinLock<>;
 }
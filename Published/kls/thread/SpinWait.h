@@ -22,8 +22,12 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <thread>
 #include <limits>
+#include <cstdint>
+#include "kls/hal/Perf.h"
 
 #if __has_include(<x86intrin.h>)
 #include <x86intrin.h>
@@ -41,14 +45,32 @@ namespace kls::thread {
         static constexpr unsigned int YieldThreshold = 10; // When to switch over to a true yield.
         static constexpr unsigned int Sleep0EveryHowManyYields = 5; // After how many yields should we Sleep(0)?
         static constexpr unsigned int DefaultSleep1Threshold = 20; // After how many yields should we Sleep(1) frequently?
-        static bool IsSingleProcessor;
     public:
-        static unsigned int OptimalMaxSpinWaitsPerSpinIteration;
-        static unsigned int SpinCountForSpinBeforeWait;
+        // Both come from Topology, which is only discovered the first time either is asked for rather than
+        // before main(), and are safe to use from static initializers of other translation units
+        [[nodiscard]] static bool single_processor() noexcept;
+
+        [[nodiscard]] static unsigned int spin_count_before_wait() noexcept;
+
+        // IDLE instructions making up the longest spin iteration, zero until calibrated. Calibration runs in
+        // the background the first time a spin needs the value, until then a conservative default is used.
+        // KLS_THREAD_SPIN_CALIBRATION in the environment or set_calibration() skip the measurement entirely.
+        static std::atomic<unsigned int> OptimalMaxSpinWaitsPerSpinIteration;
+
+        [[nodiscard]] static unsigned int optimal_max_spin_waits() noexcept {
+            const auto value = OptimalMaxSpinWaitsPerSpinIteration.load(std::memory_order_relaxed);
+            return value ? value : calibrate_lazily();
+        }
+
+        // Measures the processor on the calling thread for 10ms, stores and returns the result so that it
+        // can be persisted and fed back through set_calibration() by later runs
+        static unsigned int calibrate() noexcept;
+
+        static void set_calibration(unsigned int value) noexcept;
 
         [[nodiscard]] unsigned int count() const noexcept { return m_count; }
 
-        [[nodiscard]] bool will_yield() const noexcept { return m_count >= YieldThreshold || IsSingleProcessor; }
+        [[nodiscard]] bool will_yield() const noexcept { return m_count >= YieldThreshold || single_processor(); }
 
         void once() noexcept { once_core(DefaultSleep1Threshold); }
 
@@ -62,10 +84,12 @@ namespace kls::thread {
     private:
         unsigned int m_count = 0;
 
+        static unsigned int calibrate_lazily() noexcept;
+
         void once_core(const unsigned int threshold) noexcept {
             if ((m_count >= YieldThreshold
                 && ((m_count >= threshold && threshold >= 0) || (m_count - YieldThreshold) % 2 == 0))
-                || IsSingleProcessor) {
+                || single_processor()) {
                 if (m_count >= threshold && threshold >= 0) {
                     std::this_thread::sleep_for(std::chrono::milliseconds(1));
                 }
@@ -78,7 +102,7 @@ namespace kls::thread {
                 }
             }
             else {
-                auto n = OptimalMaxSpinWaitsPerSpinIteration;
+                auto n = optimal_max_spin_waits();
                 if (m_count <= 30 && (1u << m_count) < n) { n = 1u << m_count; }
                 spin(n);
             }
@@ -88,5 +112,80 @@ namespace kls::thread {
         }
 
         static void spin(const unsigned int iterations) noexcept { for (auto i = 0u; i < iterations; ++i) { IDLE; } }
+
+        friend class AdaptiveSpinWait;
+    };
+
+    // Spin budget of one call site, in nanoseconds. Every finished wait reports how long it took in total:
+    // waits that a longer spin would have covered pull the budget towards twice their length, waits that
+    // no reasonable spin would have covered pull it down to the minimum. The spin phase thus follows how
+    // long the awaited condition is actually held, the way glibc adaptive mutexes track their spin count.
+    class SpinBudget {
+    public:
+        static constexpr uint32_t MinNs = 250, MaxNs = 64000, InitialNs = 4000;
+
+        [[nodiscard]] uint32_t ns() const noexcept { return m_ns.load(std::memory_order_relaxed); }
+
+        void record(const uint64_t waited_ns) noexcept {
+            const auto current = static_cast<int64_t>(ns());
+            auto target = static_cast<int64_t>(MinNs);
+            if (waited_ns <= MaxNs / 2 && waited_ns * 2 > MinNs) target = static_cast<int64_t>(waited_ns * 2);
+            m_ns.store(static_cast<uint32_t>(current + (target - current) / 8), std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint32_t> m_ns{ InitialNs };
+    };
+
+    // SpinWait driven by a time budget instead of an iteration ladder. once() keeps issuing the longest
+    // spin iteration until the budget of the call site has elapsed, then continues with the yield and
+    // sleep stages of SpinWait. complete() reports the total wait back to the budget.
+    class AdaptiveSpinWait {
+    public:
+        explicit AdaptiveSpinWait(SpinBudget& budget) noexcept:
+                m_budget(budget), m_start(now()),
+                m_deadline(SpinWait::single_processor() ? m_start : m_start + budget.ns()) {}
+
+        [[nodiscard]] unsigned int count() const noexcept { return m_spins + m_fallback.count(); }
+
+        // True while the budget has not run out, the point where a blocking caller should park instead
+        [[nodiscard]] bool spinning() const noexcept { return !m_expired && now() < m_deadline; }
+
+        void once() noexcept {
+            if (!m_expired) {
+                if (now() < m_deadline) {
+                    SpinWait::spin(SpinWait::optimal_max_spin_waits());
+                    ++m_spins;
+                    return;
+                }
+                m_expired = true;
+                m_fallback.m_count = SpinWait::YieldThreshold;
+            }
+            m_fallback.once();
+        }
+
+        void complete() noexcept { m_budget.record(now() - m_start); }
+
+        // Nanoseconds from the performance counter, or from steady_clock where there is none. The scale is
+        // a local static so that waits from static initializers of other translation units see it set.
+        [[nodiscard]] static uint64_t now() noexcept {
+            static const double NsPerTick = []() noexcept {
+                const auto ticksPerSecond = kls::hal::performance::frequency();
+                return ticksPerSecond && *ticksPerSecond > 0 ? 1e9 / static_cast<double>(*ticksPerSecond) : 0.0;
+            }();
+            if (NsPerTick > 0) {
+                if (const auto ticks = kls::hal::performance::counter(); ticks)
+                    return static_cast<uint64_t>(static_cast<double>(*ticks) * NsPerTick);
+            }
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+    private:
+        SpinBudget& m_budget;
+        const uint64_t m_start, m_deadline;
+        unsigned int m_spins = 0;
+        bool m_expired = false;
+        SpinWait m_fallback{};
     };
 }
@@ -39,13 +39,41 @@ namespace kls::thread {
 
         constexpr uint32_t invalid_key = 0xffffffff;
 
-        uint32_t create(Cleanup callback);
+        // Every created key gets a fresh generation while its index may be recycled. Slots remember the
+        // generation they were written under, so values left behind by a deleted key are told apart from
+        // values of a later key reusing the index and can be cleaned up lazily.
+        struct Generation;
+
+        struct Key {
+            uint32_t index;
+            Generation* generation;
+        };
+
+        struct Slot {
+            void* value;
+            Generation* generation;
+        };
 
-        void remove(uint32_t key) noexcept;
+        // Keys below this are stored in an array inline in the per-thread context, the rest spill over
+        constexpr uint32_t inline_slots = 64;
 
-        void* get(uint32_t key) noexcept;
+        // The inline slot array of the calling thread, null until the thread first touched its context
+        extern constinit thread_local Slot* fast_slots;
 
-        void set(uint32_t key, void* p);
+        Key create(Cleanup callback);
+
+        void remove(Key key) noexcept;
+
+        void* get_slow(Key key) noexcept;
+
+        inline void* get(Key key) noexcept {
+            if (const auto slots = fast_slots; slots && key.index < inline_slots) {
+                if (const auto& slot = slots[key.index]; slot.generation == key.generation) return slot.value;
+            }
+            return get_slow(key);
+        }
+
+        void set(Key key, void* p);
 
         template<class T>
         class PointerBase {
@@ -58,12 +86,13 @@ namespace kls::thread {
 
             PointerBase& operator=(PointerBase const&) = delete;
 
-            PointerBase(PointerBase&& other) noexcept : m_key(other.m_key) { other.m_key = invalid_key; }
+            PointerBase(PointerBase&& other) noexcept : m_key(other.m_key) { other.m_key = { invalid_key, nullptr }; }
 
             PointerBase& operator=(PointerBase&& other) noexcept {
-                if (m_key != invalid_key) remove(m_key);
+                if (m_key.index != invalid_key) remove(m_key);
                 m_key = other.m_key;
-                other.m_key = invalid_key;
+                other.m_key = { invalid_key, nullptr };
+                return *this;
             }
 
             ~PointerBase() noexcept { remove(m_key); }
@@ -77,7 +106,7 @@ namespace kls::thread {
             bool operator!() const noexcept { return !get(); }
 
         protected:
-            uint32_t m_key;
+            Key m_key;
         };
 
         template<class T, class Alloc, bool IsSame>
@@ -133,6 +162,12 @@ namespace kls::thread {
 
             PointerAllocBase& operator=(PointerAllocBase&&) = delete;
 
+            // The cleanup routine needs m_alloc, so the key has to go before the members do
+            ~PointerAllocBase() noexcept {
+                remove(PointerBase<T>::m_key);
+                PointerBase<T>::m_key = { invalid_key, nullptr };
+            }
+
         private:
             Alloc m_alloc;
             const Cleanup m_cleanup = get_cleanup();
@@ -0,0 +1,187 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include "Futex.h"
+#include "SpinLock.h"
+#include "Executor.h"
+#include "Semaphore.h"
+#include "Topology.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Work stealing thread pool. Every worker owns a Chase-Lev deque: tasks submitted from a worker go to the
+    // bottom of its own deque and run LIFO, idle workers steal from the top of a randomly chosen victim.
+    // Tasks submitted from outside the pool go through a small injection queue. Idle workers search with
+    // SpinWait for a while and then park on a Semaphore. Submitting from a worker only wakes a sleeper when no
+    // other worker is already searching, and parallel_for wakes as many as it can feed in a single signal.
+    class ThreadPool: public AddressSensitive, public Executor {
+    public:
+        // Unit of work, run exactly once and deleted afterwards
+        class Task {
+        public:
+            virtual ~Task() = default;
+
+            virtual void run() noexcept = 0;
+        };
+
+        explicit ThreadPool(unsigned int workers = Topology::get().concurrency());
+
+        // Runs every task that is still queued before the workers are joined
+        ~ThreadPool() noexcept;
+
+        [[nodiscard]] unsigned int size() const noexcept { return static_cast<unsigned int>(m_workers.size()); }
+
+        // Tasks must not throw
+        template<class Fn>
+        void submit(Fn&& fn) { enqueue(new FnTask<std::decay_t<Fn>>(std::forward<Fn>(fn)), 1); }
+
+        // Calls body(i) for every i in [begin, end), recursively split into chunks of at most grain indices.
+        // Returns once every call has finished, a calling worker runs other tasks in the meantime.
+        template<class Fn>
+        void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, Fn&& body) {
+            if (begin >= end) return;
+            if (!grain) grain = 1;
+            Join join{};
+            const auto chunks = (end - begin + grain - 1) / grain;
+            const auto wakes = chunks < size() ? static_cast<unsigned int>(chunks) : size();
+            enqueue(new RangeTask<std::remove_reference_t<Fn>>(*this, join, body, begin, end, grain), wakes);
+            wait(join);
+        }
+
+        // Executor hook, resumes the coroutine as a task of the pool. The handle is queued in place of a task
+        // pointer without allocating one. Only growing a queue can still allocate, and failing there
+        // terminates on purpose: the coroutine is already suspended and would otherwise never be resumed.
+        void post(std::coroutine_handle<> handle) noexcept override { enqueue(tag(handle), 1); }
+
+        // Blocks until the pool is quiescent, i.e. every task submitted so far has finished. That includes
+        // tasks submitted by tasks and by other threads while waiting, so a steady stream of submissions from
+        // elsewhere can keep it waiting indefinitely. Must not be called from a task.
+        void wait_idle() noexcept;
+
+    private:
+        struct Worker;
+
+        class Join {
+        public:
+            void add() noexcept { m_state.fetch_add(1, std::memory_order_relaxed); }
+
+            void done() noexcept {
+                const auto prev = m_state.fetch_sub(1, std::memory_order_acq_rel);
+                if ((prev & CountMask) == 1 && (prev & SleepingBit)) futex::wake_all(m_state);
+            }
+
+            [[nodiscard]] bool finished() const noexcept {
+                return !(m_state.load(std::memory_order_acquire) & CountMask);
+            }
+
+        private:
+            friend class ThreadPool;
+            static constexpr uint32_t SleepingBit = 0x80000000u, CountMask = ~SleepingBit;
+            std::atomic<uint32_t> m_state{ 1 };
+        };
+
+        template<class Fn>
+        class FnTask final: public Task {
+        public:
+            template<class F>
+            explicit FnTask(F&& fn) : m_fn(std::forward<F>(fn)) {}
+
+            void run() noexcept override { m_fn(); }
+
+        private:
+            Fn m_fn;
+        };
+
+        template<class Fn>
+        class RangeTask final: public Task {
+        public:
+            RangeTask(ThreadPool& pool, Join& join, Fn& body, std::size_t begin, std::size_t end, std::size_t grain) :
+                    m_pool(pool), m_join(join), m_body(body), m_begin(begin), m_end(end), m_grain(grain) {}
+
+            void run() noexcept override {
+                // Hand the upper halves to thieves and keep splitting the lower one
+                while (m_end - m_begin > m_grain) {
+                    const auto mid = m_begin + (m_end - m_begin) / 2;
+                    m_join.add();
+                    m_pool.enqueue(new RangeTask(m_pool, m_join, m_body, mid, m_end, m_grain), 1);
+                    m_end = mid;
+                }
+                for (auto i = m_begin; i < m_end; ++i) m_body(i);
+                m_join.done();
+            }
+
+        private:
+            ThreadPool& m_pool;
+            Join& m_join;
+            Fn& m_body;
+            std::size_t m_begin, m_end;
+            const std::size_t m_grain;
+        };
+
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        SpinLock m_inject_lock;
+        std::deque<Task*> m_injected;
+        std::atomic<std::size_t> m_injected_size{ 0 };
+        std::atomic<uint64_t> m_external_submitted{ 0 };
+        std::atomic<uint32_t> m_searching{ 0 }, m_sleepers{ 0 };
+        std::atomic<uint32_t> m_idle_waiters{ 0 }, m_idle_epoch{ 0 };
+        std::atomic_bool m_stop{ false };
+        Semaphore m_sleep;
+
+        // Coroutine frames are at least pointer aligned, so the low bit tells queued handles from tasks
+        static constexpr uintptr_t HandleTag = 1;
+
+        static Task* tag(std::coroutine_handle<> handle) noexcept {
+            return reinterpret_cast<Task*>(reinterpret_cast<uintptr_t>(handle.address()) | HandleTag);
+        }
+
+        static Worker*& current() noexcept;
+
+        void enqueue(Task* task, unsigned int wakes);
+
+        void wait(Join& join) noexcept;
+
+        void run_worker(Worker& self) noexcept;
+
+        Task* find_task(Worker& self) noexcept;
+
+        void execute(Worker& self, Task* task) noexcept;
+
+        [[nodiscard]] bool has_work() const noexcept;
+
+        [[nodiscard]] bool quiescent() const noexcept;
+
+        void park() noexcept;
+
+        void wake(unsigned int count) noexcept;
+    };
+}
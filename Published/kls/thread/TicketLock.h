@@ -0,0 +1,77 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <cstdint>
+#include "SpinWait.h"
+#include "CacheLine.h"
+#include "LockStats.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // FIFO spin lock. Waiters take a ticket and wait for it to be served, so the lock is handed over in
+    // arrival order and no thread can starve.
+    template<class Stats = stats::Disabled>
+    class BasicTicketLock: public AddressSensitive {
+    public:
+        void lock() noexcept {
+            const auto ticket = mNext.fetch_add(1, std::memory_order_relaxed);
+            if (mServing.load(std::memory_order_acquire) == ticket) {
+                mStats.acquired();
+                return;
+            }
+            const auto since = mStats.contended();
+            mStats.acquired(since, wait_for_turn(ticket));
+        }
+
+        bool try_lock() noexcept {
+            auto serving = mServing.load(std::memory_order_acquire);
+            if (!mNext.compare_exchange_strong(serving, serving + 1, std::memory_order_acquire)) return false;
+            mStats.acquired();
+            return true;
+        }
+
+        void unlock() noexcept {
+            mStats.released();
+            mServing.store(mServing.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+    private:
+        unsigned int wait_for_turn(const uint32_t ticket) const noexcept {
+            // Sleeping would stall every thread queued behind us, so only back off as far as a yield
+            SpinWait spinner{};
+            while (mServing.load(std::memory_order_acquire) != ticket) {
+                spinner.once(std::numeric_limits<unsigned int>::max());
+            }
+            return spinner.count();
+        }
+
+        alignas(CacheLineSize) std::atomic<uint32_t> mNext = { 0 };
+        alignas(CacheLineSize) std::atomic<uint32_t> mServing = { 0 };
+        [[no_unique_address]] Stats mStats{};
+    };
+
+    using TicketLock = BasicTicketLock<>;
+}
@@ -0,0 +1,74 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+namespace kls::thread {
+    // Processor topology of the process as far as it is allowed to run, discovered once on first use.
+    // On Linux it combines the affinity mask, /sys/devices/system/{cpu,node} and the CPU quota of the
+    // cgroup; elsewhere it falls back to std::thread::hardware_concurrency() with a flat layout.
+    class Topology {
+    public:
+        struct Cpu {
+            unsigned int id, core, package, node;
+        };
+
+        static const Topology& get() noexcept;
+
+        // CPUs in the affinity mask of the process, ordered by id
+        [[nodiscard]] const std::vector<Cpu>& cpus() const noexcept { return m_cpus; }
+
+        // Distinct physical cores among cpus(), fewer than cpus() with SMT
+        [[nodiscard]] unsigned int cores() const noexcept { return m_cores; }
+
+        [[nodiscard]] unsigned int nodes() const noexcept { return m_nodes; }
+
+        // How many threads can actually run at the same time: the allowed CPUs, capped by the cgroup quota.
+        // This is what spinning and thread pool sizing should be based on.
+        [[nodiscard]] unsigned int concurrency() const noexcept { return m_concurrency; }
+
+        [[nodiscard]] unsigned int node_of(unsigned int cpu) const noexcept;
+
+        // The CPU the caller is running on right now, which may change at any moment. 0 where unknown.
+        static unsigned int current_cpu() noexcept;
+
+        [[nodiscard]] unsigned int current_node() const noexcept { return node_of(current_cpu()); }
+
+        // Restrict the calling thread to one CPU or to the allowed CPUs of one NUMA node.
+        // Return false if the platform does not support it or the request was refused.
+        bool pin_current_thread(unsigned int cpu) const noexcept;
+
+        bool pin_current_thread_to_node(unsigned int node) const noexcept;
+
+        // Undo pinning, back to every CPU the process was allowed to use at startup
+        bool unpin_current_thread() const noexcept;
+
+    private:
+        std::vector<Cpu> m_cpus{};
+        unsigned int m_cores = 1, m_nodes = 1, m_concurrency = 1;
+
+        Topology() noexcept;
+    };
+}
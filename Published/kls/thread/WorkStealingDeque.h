@@ -0,0 +1,124 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <type_traits>
+#include "CacheLine.h"
+#include "kls/Object.h"
+
+namespace kls::thread {
+    // Chase-Lev work stealing deque, with the memory orderings of Le, Pop, Cohen and Zappa Nardelli.
+    // The owning thread pushes and pops at the bottom, any other thread may steal from the top.
+    // The buffer grows on demand, outgrown buffers are kept until destruction as thieves may still read them.
+    template<class T>
+    class WorkStealingDeque: public AddressSensitive {
+        static_assert(std::is_trivially_copyable_v<T>, "elements are copied racily and must be trivially copyable");
+    public:
+        explicit WorkStealingDeque(std::size_t capacity = 256) {
+            std::size_t size = 2;
+            while (size < capacity) size <<= 1;
+            m_buffers.push_back(std::make_unique<Buffer>(size));
+            m_buffer.store(m_buffers.back().get(), std::memory_order_relaxed);
+        }
+
+        // Owner only
+        void push(T value) {
+            const auto b = m_bottom.load(std::memory_order_relaxed);
+            const auto t = m_top.load(std::memory_order_acquire);
+            auto buffer = m_buffer.load(std::memory_order_relaxed);
+            if (b - t > static_cast<int64_t>(buffer->mask)) buffer = grow(buffer, t, b);
+            buffer->put(b, value);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        // Owner only
+        std::optional<T> pop() noexcept {
+            const auto b = m_bottom.load(std::memory_order_relaxed) - 1;
+            const auto buffer = m_buffer.load(std::memory_order_relaxed);
+            m_bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto t = m_top.load(std::memory_order_relaxed);
+            if (t > b) {
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+                return std::nullopt;
+            }
+            const auto value = buffer->get(b);
+            if (t == b) {
+                // Last element, race the thieves for it
+                const auto won = m_top.compare_exchange_strong(
+                        t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed
+                );
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+                if (!won) return std::nullopt;
+            }
+            return value;
+        }
+
+        // Any thread, fails spuriously when racing another thief or the owner
+        std::optional<T> steal() noexcept {
+            auto t = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const auto b = m_bottom.load(std::memory_order_acquire);
+            if (t >= b) return std::nullopt;
+            const auto value = m_buffer.load(std::memory_order_acquire)->get(t);
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return std::nullopt;
+            return value;
+        }
+
+        [[nodiscard]] bool empty() const noexcept {
+            return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Buffer {
+            const std::size_t mask;
+            const std::unique_ptr<std::atomic<T>[]> items;
+
+            explicit Buffer(std::size_t size) : mask(size - 1), items(std::make_unique<std::atomic<T>[]>(size)) {}
+
+            T get(int64_t i) const noexcept { return items[i & mask].load(std::memory_order_relaxed); }
+
+            void put(int64_t i, T value) noexcept { items[i & mask].store(value, std::memory_order_relaxed); }
+        };
+
+        alignas(CacheLineSize) std::atomic<int64_t> m_top{ 0 };
+        alignas(CacheLineSize) std::atomic<int64_t> m_bottom{ 0 };
+        std::atomic<Buffer*> m_buffer{ nullptr };
+        std::vector<std::unique_ptr<Buffer>> m_buffers;
+
+        Buffer* grow(const Buffer* buffer, int64_t t, int64_t b) {
+            m_buffers.push_back(std::make_unique<Buffer>((buffer->mask + 1) * 2));
+            const auto next = m_buffers.back().get();
+            for (auto i = t; i < b; ++i) next->put(i, buffer->get(i));
+            m_buffer.store(next, std::memory_order_release);
+            return next;
+        }
+    };
+}